@@ -0,0 +1,161 @@
+//==============================================================================
+/**
+@file       AttributeIndexBenchmark.cpp
+@brief      Runs the searches of the dom parser on synthetic status pages with the attribute index
+			and with the linear search it replaced, checks they find the same tags and times both.
+			Not part of the plugin, build it on its own from the Sources folder with the htmlcxx sources:
+				cl /O2 /EHsc /std:c++17 /I Vendor\htmlcxx\html Benchmarks\AttributeIndexBenchmark.cpp
+					Vendor\htmlcxx\html\ParserDom.cc Vendor\htmlcxx\html\ParserSax.cc Vendor\htmlcxx\html\Node.cc
+					Vendor\htmlcxx\html\Extensions.cc Vendor\htmlcxx\html\Uri.cc Vendor\htmlcxx\html\utils.cc
+				g++ -O2 -std=c++17 -I Vendor/htmlcxx/html Benchmarks/AttributeIndexBenchmark.cpp
+					Vendor/htmlcxx/html/{ParserDom,ParserSax,Node,Extensions,Uri,utils}.cc -o AttributeIndexBenchmark
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#include "../Windows/HtmlcxxUtils.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+namespace
+{
+	typedef tree<htmlcxx::HTML::Node> tree_t;
+
+	/**
+		@brief Build a page shaped like the builders' progress report
+
+		@param[in] regions number of regions
+		@param[in] dataCenters data centers per region
+		@param[in] worlds worlds per data center
+
+		@return the html
+	**/
+	std::string makePage(int regions, int dataCenters, int worlds)
+	{
+		std::string html = "<html><body><div class=\"report-region_select\">";
+		for (int r = 0; r < regions; r++)
+			html += "<a href=\"#region" + std::to_string(r) + "\">Region " + std::to_string(r) + "</a>";
+		html += "</div>";
+
+		for (int r = 0; r < regions; r++)
+		{
+			html += "<div class=\"report-region\">";
+			for (int d = 0; d < dataCenters; d++)
+			{
+				html += "<h2 class=\"report-dc_name\">DC " + std::to_string(r) + "-" + std::to_string(d) + "</h2>";
+				html += "<ul class=\"report-world_list\">";
+				for (int w = 0; w < worlds; w++)
+				{
+					html += "<li class=\"item\"><span class=\"world_name\">World " + std::to_string(w) + "</span>"
+						"<div class=\"progress\" data-world=\"" + std::to_string(w) + "\" style=\"display:block\">"
+						"<span class=\"level\">Level " + std::to_string(w % 5 + 1) + "</span>"
+						"<div class=\"bar\"><span style=\"width:" + std::to_string(w % 100) + "%\"></span>" + std::to_string(w % 100) + "%</div>"
+						"<span class=\"text\">Construction in progress</span></div></li>";
+				}
+				html += "</ul>";
+			}
+			html += "</div>";
+		}
+		return html + "</body></html>";
+	}
+
+	/**
+		@brief Run the searches FirmamentTrackerHelper::parseRestorationServerHtml and parseServerData make
+
+		@param[in] dom the parsed page
+		@param[in] find the attribute search, called like htmlcxxFindNextAttribute
+
+		@return the text of every tag found, in order, to compare the searches by
+	**/
+	template <class F>
+	std::string runSearches(tree_t& dom, F find)
+	{
+		std::string found;
+		auto regionIt = find("class", "report-region_select", dom.begin(), dom.end());
+		if (regionIt == dom.end())
+			return found;
+
+		for (auto regionDivIt = dom.next_sibling(regionIt); regionDivIt != dom.end() && regionDivIt != NULL;
+			regionDivIt = dom.next_sibling(regionDivIt))
+		{
+			if (!(regionDivIt->isTag() && htmlcxxutils::strCaseCmp(regionDivIt->tagName(), "div")))
+				continue;
+
+			for (auto dcIt = find("class", "report-dc_name", regionDivIt.begin(), regionDivIt.end());
+				dcIt != htmlcxxutils::pre_order_it(regionDivIt.end());
+				dcIt = find("class", "report-dc_name", dcIt.begin(), regionDivIt.end()))
+			{
+				found += dom.child(dcIt, 0)->text();
+
+				auto worldListIt = find("class", "report-world_list", dcIt.begin(), regionDivIt.end());
+				if (worldListIt == htmlcxxutils::pre_order_it(regionDivIt.end()))
+					break;
+
+				for (auto liIt = htmlcxxutils::htmlcxxFindNextTag("li", worldListIt.begin(), worldListIt.end());
+					liIt != htmlcxxutils::pre_order_it(worldListIt.end());
+					liIt = htmlcxxutils::htmlcxxFindNextTag("li", liIt.end(), worldListIt.end()))
+				{
+					tree_t::pre_order_iterator liEnd = liIt.end();
+					auto worldNameIt = find("class", "world_name", liIt.begin(), liEnd);
+					if (worldNameIt == liEnd)
+						continue;
+					found += dom.child(worldNameIt, 0)->text();
+
+					for (const char* name : { "level", "bar", "text", "missing" })
+					{
+						auto it = find("class", name, worldNameIt.end(), liEnd);
+						found += it == liEnd ? std::string("-") : it->text();
+					}
+				}
+			}
+		}
+		return found;
+	}
+
+	double sinceMs(std::chrono::steady_clock::time_point start)
+	{
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+}
+
+int main()
+{
+	int mismatches = 0;
+	for (int worlds : { 8, 40, 200 })
+	{
+		std::string html = makePage(4, 2, worlds);
+		htmlcxx::HTML::ParserDom parser;
+
+		// each search gets its own tree, the linear search parses the attributes of the tags it visits
+		tree_t linearDom = parser.parseTree(html);
+		auto start = std::chrono::steady_clock::now();
+		std::string linearFound = runSearches(linearDom,
+			[](const std::string& name, const std::string& value, tree_t::pre_order_iterator begin, tree_t::pre_order_iterator end)
+			{
+				return htmlcxxutils::htmlcxxFindNextAttribute(name, value, begin, end);
+			});
+		double linearMs = sinceMs(start);
+
+		tree_t indexedDom = parser.parseTree(html);
+		start = std::chrono::steady_clock::now();
+		htmlcxxutils::AttributeIndex index(indexedDom);
+		double buildMs = sinceMs(start);
+		start = std::chrono::steady_clock::now();
+		std::string indexedFound = runSearches(indexedDom,
+			[&index](const std::string& name, const std::string& value, tree_t::pre_order_iterator begin, tree_t::pre_order_iterator end)
+			{
+				return index.findNextAttribute(name, value, begin, end);
+			});
+		double searchMs = sinceMs(start);
+
+		bool isSame = linearFound == indexedFound && !linearFound.empty();
+		if (!isSame)
+			mismatches++;
+		printf("%zu KB, %d nodes: %s, linear %.2fms, index build %.2fms + searches %.2fms\n",
+			html.size() / 1024, indexedDom.size(), isSame ? "same tags" : "MISMATCH", linearMs, buildMs, searchMs);
+	}
+
+	return mismatches == 0 ? 0 : 1;
+}
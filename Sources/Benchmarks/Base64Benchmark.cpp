@@ -0,0 +1,109 @@
+//==============================================================================
+/**
+@file       Base64Benchmark.cpp
+@brief      Checks the SSSE3 and AVX2 base64 encoders against the scalar one and times them.
+			Not part of the plugin, build it on its own from the Sources folder:
+				cl /O2 /EHsc /std:c++17 Benchmarks\Base64Benchmark.cpp
+				g++ -O2 -std=c++17 Benchmarks/Base64Benchmark.cpp -o Base64Benchmark
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#include "../Windows/ImageUtils.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace
+{
+	typedef void (*encoder_t)(char*, const unsigned char*, std::size_t);
+
+	struct namedEncoder_t
+	{
+		const char* name;
+		encoder_t encode;
+	};
+
+	std::size_t encodedSize(std::size_t size)
+	{
+		return 4 * ((size + 2) / 3);
+	}
+
+	double timeUs(encoder_t encode, const std::vector<unsigned char>& in, std::string& out, int iterations)
+	{
+		// warm up the caches before the clock starts
+		encode(&out[0], in.data(), in.size());
+
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+			encode(&out[0], in.data(), in.size());
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+	}
+}
+
+int main()
+{
+	std::vector<namedEncoder_t> encoders = { { "scalar", imageutils::base64EncodeScalar } };
+#ifdef IMAGEUTILS_X86
+	int simdLevel = imageutils::detectSimdLevel();
+	if (simdLevel >= 1)
+		encoders.push_back({ "SSSE3", imageutils::base64EncodeSSSE3 });
+	if (simdLevel >= 2)
+		encoders.push_back({ "AVX2", imageutils::base64EncodeAVX2 });
+#endif
+	encoders.push_back({ "dispatched", imageutils::base64Encode });
+
+	// equivalence, every length up to MAX_LENGTH at a few alignments of the input
+	const std::size_t MAX_LENGTH = 2000;
+	std::mt19937 random(1);
+	std::vector<unsigned char> data(MAX_LENGTH + 16);
+	for (auto& byte : data)
+		byte = (unsigned char)random();
+
+	int mismatches = 0;
+	int cases = 0;
+	std::string expected;
+	std::string actual;
+	for (std::size_t length = 0; length <= MAX_LENGTH; length++)
+	{
+		for (std::size_t alignment = 0; alignment < 4; alignment++)
+		{
+			const unsigned char* in = data.data() + alignment;
+			expected.assign(encodedSize(length) + 1, '\0');
+			imageutils::base64EncodeScalar(&expected[0], in, length);
+			for (std::size_t i = 1; i < encoders.size(); i++)
+			{
+				// the guard byte catches writes past the end
+				actual.assign(encodedSize(length) + 1, '\0');
+				encoders[i].encode(&actual[0], in, length);
+				if (actual != expected)
+				{
+					printf("mismatch: %s, length %zu, alignment %zu\n", encoders[i].name, length, alignment);
+					mismatches++;
+				}
+				cases++;
+			}
+		}
+	}
+	printf("equivalence: %d cases, %d mismatches\n", cases, mismatches);
+
+	// throughput on an icon sized buffer and a large one
+	for (std::size_t size : { (std::size_t)20 * 1024, (std::size_t)4 * 1024 * 1024 })
+	{
+		std::vector<unsigned char> in(size);
+		for (auto& byte : in)
+			byte = (unsigned char)random();
+		std::string out(encodedSize(size), '\0');
+		int iterations = size < 1024 * 1024 ? 20000 : 50;
+
+		printf("%zu bytes:", size);
+		for (const auto& encoder : encoders)
+			printf(" %s %.2fus", encoder.name, timeUs(encoder.encode, in, out, iterations));
+		printf("\n");
+	}
+
+	return mismatches == 0 ? 0 : 1;
+}
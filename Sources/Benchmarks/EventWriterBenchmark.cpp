@@ -0,0 +1,136 @@
+//==============================================================================
+/**
+@file       EventWriterBenchmark.cpp
+@brief      Checks ESDEventWriter against the json path it replaced and times both.
+			Not part of the plugin, build it on its own from the Sources folder:
+				cl /O2 /EHsc /std:c++17 Benchmarks\EventWriterBenchmark.cpp
+				g++ -O2 -std=c++17 Benchmarks/EventWriterBenchmark.cpp -o EventWriterBenchmark
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#include "../Common/ESDEventWriter.h"
+#include "../Vendor/json/src/json.hpp"
+using json = nlohmann::json;
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+
+namespace
+{
+	const std::string IMAGE_PREFIX = "data:image/png;base64,";
+
+	// the messages as ESDConnectionManager built them before the writer, empty if json::dump() throws
+	std::string jsonSetTitle(const std::string& context, const std::string& title, ESDSDKTarget target)
+	{
+		json jsonObject;
+		jsonObject[kESDSDKCommonEvent] = kESDSDKEventSetTitle;
+		jsonObject[kESDSDKCommonContext] = context;
+
+		json payload;
+		payload[kESDSDKPayloadTarget] = target;
+		payload[kESDSDKPayloadTitle] = title;
+		jsonObject[kESDSDKCommonPayload] = payload;
+
+		try
+		{
+			return jsonObject.dump();
+		}
+		catch (const json::exception&)
+		{
+			return "";
+		}
+	}
+
+	std::string jsonSetImage(const std::string& context, const std::string& image, ESDSDKTarget target)
+	{
+		json jsonObject;
+		jsonObject[kESDSDKCommonEvent] = kESDSDKEventSetImage;
+		jsonObject[kESDSDKCommonContext] = context;
+
+		json payload;
+		payload[kESDSDKPayloadTarget] = target;
+		payload[kESDSDKPayloadImage] = IMAGE_PREFIX + image;
+		jsonObject[kESDSDKCommonPayload] = payload;
+
+		try
+		{
+			return jsonObject.dump();
+		}
+		catch (const json::exception&)
+		{
+			return "";
+		}
+	}
+
+	// short strings biased towards the characters the writer escapes or validates
+	std::string randomString(std::mt19937& random)
+	{
+		static const unsigned char SPECIAL[] = { '"', '\\', '\b', '\f', '\n', '\r', '\t', 0x01, 0x1F, 0x7F,
+			0xC3, 0xA9, 0xE2, 0x82, 0xAC, 0xF0, 0x9F, 0x98, 0x80, 0xED, 0xA0, 0xC0, 0xFF };
+		std::string out(random() % 24, ' ');
+		for (auto& c : out)
+		{
+			if (random() % 3 == 0)
+				c = (char)SPECIAL[random() % sizeof(SPECIAL)];
+			else
+				c = (char)(0x20 + random() % 0x5F);
+		}
+		return out;
+	}
+
+	template <class F>
+	double timeUs(int iterations, F func)
+	{
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < iterations; i++)
+			func();
+		return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count() / iterations;
+	}
+}
+
+int main()
+{
+	// equivalence, the writer gives the same bytes or refuses the same strings json::dump() throws for
+	std::mt19937 random(1);
+	std::string buffer;
+	int mismatches = 0;
+	const int CASES = 300000;
+	for (int i = 0; i < CASES; i++)
+	{
+		std::string context = randomString(random);
+		std::string text = randomString(random);
+		ESDSDKTarget target = (ESDSDKTarget)(random() % 3);
+
+		std::string expected = jsonSetTitle(context, text, target);
+		bool isWritten = ESDEventWriter::WriteSetTitle(buffer, context, text, target);
+		if (isWritten != !expected.empty() || (isWritten && buffer != expected))
+			mismatches++;
+
+		expected = jsonSetImage(context, text, target);
+		isWritten = ESDEventWriter::WriteSetImage(buffer, context, IMAGE_PREFIX.c_str(), IMAGE_PREFIX.length(), text, target);
+		if (isWritten != !expected.empty() || (isWritten && buffer != expected))
+			mismatches++;
+	}
+	printf("equivalence: %d cases, %d mismatches\n", 2 * CASES, mismatches);
+
+	// timing of an icon sized image message
+	static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	std::string image(20 * 1024, 'A');
+	for (auto& c : image)
+		c = BASE64[random() % 64];
+	const std::string context = "E5F2C1A0B3D4E5F60718293A4B5C6D7E";
+	const int ITERATIONS = 20000;
+	std::size_t sink = 0;
+	double jsonUs = timeUs(ITERATIONS, [&]() { sink += jsonSetImage(context, image, kESDSDKTarget_HardwareAndSoftware).size(); });
+	double writerUs = timeUs(ITERATIONS, [&]()
+		{
+			ESDEventWriter::WriteSetImage(buffer, context, IMAGE_PREFIX.c_str(), IMAGE_PREFIX.length(), image, kESDSDKTarget_HardwareAndSoftware);
+			sink += buffer.size();
+		});
+	printf("setImage with a %zu byte image: json %.1fus, writer %.1fus, %zu bytes written\n", image.size(), jsonUs, writerUs, sink);
+
+	return mismatches == 0 ? 0 : 1;
+}
@@ -0,0 +1,99 @@
+//==============================================================================
+/**
+@file       PngEncodeBenchmark.cpp
+@brief      Times the png encode profiles of the progress images on the bundled icons and
+			checks that every profile decodes back to the same pixels.
+			Not part of the plugin, build it on its own from the Sources folder, it links the
+			image manager and its lodepng:
+				cl /O2 /EHsc /std:c++20 /I Windows Benchmarks\PngEncodeBenchmark.cpp Windows\StreamDeckImageManager.cpp
+			Run it from the Sources folder so it finds the icons.
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#include "../Windows/StreamDeckImageManager.h"
+#include "../Vendor/lodepng/lodepng.h"
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace
+{
+	typedef StreamDeckImageManager::encodeProfile_t encodeProfile_t;
+
+	const char* ICON_PATH = "com.elgato.ffxivfirmament.sdPlugin/Images/Icons/";
+	const char* ICONS[] = { "ish1.png", "ish2.png", "ish3.png" };
+
+	struct namedProfile_t
+	{
+		const char* name;
+		encodeProfile_t profile;
+	};
+	const namedProfile_t PROFILES[] = {
+		{ "COMPACT", encodeProfile_t::COMPACT },
+		{ "FAST", encodeProfile_t::FAST },
+		{ "STORED", encodeProfile_t::STORED } };
+
+	// every other pixel of every other row, the size of the keys on the smaller decks
+	imageutils::rgbaImage_t halve(const imageutils::rgbaImage_t& image)
+	{
+		imageutils::rgbaImage_t half;
+		half.width = image.width / 2;
+		half.height = image.height / 2;
+		half.pixels.resize(half.width * half.height * 4);
+		for (unsigned int y = 0; y < half.height; y++)
+			for (unsigned int x = 0; x < half.width; x++)
+				for (unsigned int c = 0; c < 4; c++)
+					half.pixels[(y * half.width + x) * 4 + c] = image.pixels[(y * 2 * image.width + x * 2) * 4 + c];
+		return half;
+	}
+}
+
+int main()
+{
+	const int ITERATIONS = 50;
+	int mismatches = 0;
+	for (const char* icon : ICONS)
+	{
+		imageutils::rgbaImage_t image;
+		if (lodepng::decode(image.pixels, image.width, image.height, std::string(ICON_PATH) + icon) != 0)
+		{
+			printf("%s: could not be read, run from the Sources folder\n", icon);
+			return 1;
+		}
+
+		for (const auto& sized : { image, halve(image) })
+		{
+			printf("%s %ux%u:", icon, sized.width, sized.height);
+			for (const auto& profile : PROFILES)
+			{
+				std::vector<unsigned char> png;
+				StreamDeckImageManager::encodePng(png, sized, profile.profile);
+
+				auto start = std::chrono::steady_clock::now();
+				for (int i = 0; i < ITERATIONS; i++)
+				{
+					png.clear();
+					StreamDeckImageManager::encodePng(png, sized, profile.profile);
+				}
+				double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() / ITERATIONS;
+
+				// the profiles only trade size for time, the pixels must survive unchanged
+				imageutils::rgbaImage_t decoded;
+				if (lodepng::decode(decoded.pixels, decoded.width, decoded.height, png) != 0 ||
+					decoded.width != sized.width || decoded.height != sized.height || decoded.pixels != sized.pixels)
+				{
+					printf(" %s MISMATCH", profile.name);
+					mismatches++;
+					continue;
+				}
+				printf(" %s %.2fms %.1fKB", profile.name, ms, png.size() / 1024.0);
+			}
+			printf("\n");
+		}
+	}
+
+	return mismatches == 0 ? 0 : 1;
+}
@@ -43,6 +43,24 @@ public:
 		return true;
 	}
 	
+	//! Move object out by name, leaves null in its place so nothing is copied
+	static bool MoveObjectByName(json& ioJSON, const std::string& inName, json& outObject)
+	{
+		// Check desired value exists
+		json::iterator iter(ioJSON.find(inName));
+		if (iter == ioJSON.end())
+			return false;
+
+		// Check value is an object
+		if (!iter->is_object())
+			return false;
+
+		// Take value
+		outObject = std::move(*iter);
+
+		return true;
+	}
+	
 	//! Get array by name
 	static bool GetArrayByName(const json& inJSON, const std::string& inName, json& outArray)
 	{
@@ -77,6 +95,22 @@ public:
 		return *iter;
 	}
 
+	//! Move string out by name, leaves an empty string in its place so nothing is copied
+	static std::string MoveStringByName(json& ioJSON, const std::string& inName, const std::string& defaultValue = "")
+	{
+		// Check desired value exists
+		json::iterator iter(ioJSON.find(inName));
+		if (iter == ioJSON.end())
+			return defaultValue;
+
+		// Check value is a string
+		if (!iter->is_string())
+			return defaultValue;
+
+		// Take value
+		return std::move(iter->get_ref<std::string&>());
+	}
+
 	//! Get string
 	static std::string GetString(const json& j, const std::string& defaultString = "")
 	{
@@ -30,9 +30,13 @@ public:
 	
 	virtual void DeviceDidConnect(const std::string& inDeviceID, const json &inDeviceInfo) = 0;
 	virtual void DeviceDidDisconnect(const std::string& inDeviceID) = 0;
+	virtual void SystemDidWakeUp() = 0;
 
 	virtual void SendToPlugin(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID) = 0;
 
+	virtual void PropertyInspectorDidAppear(const std::string& inAction, const std::string& inContext, const std::string& inDeviceID) = 0;
+	virtual void PropertyInspectorDidDisappear(const std::string& inAction, const std::string& inContext, const std::string& inDeviceID) = 0;
+
 	virtual void DidReceiveGlobalSettings(const json& inPayload) = 0;
 	
 protected:
@@ -12,6 +12,10 @@
 
 #include "ESDConnectionManager.h"
 #include "EPLJSONUtils.h"
+#include "ESDEventWriter.h"
+
+#include <algorithm>
+#include <chrono>
 
 
 void ESDConnectionManager::OnOpen(WebsocketClient* inClient, websocketpp::connection_hdl inConnectionHandler)
@@ -63,59 +67,107 @@ void ESDConnectionManager::OnMessage(websocketpp::connection_hdl, WebsocketClien
 {
 	if (inMsg != NULL && inMsg->get_opcode() == websocketpp::frame::opcode::text)
 	{
-		std::string message = inMsg->get_payload();
+		// Parse straight from the frame, the payload is not copied
+		const std::string& message = inMsg->get_payload();
 		DebugPrint("OnMessage: %s\n", message.c_str());
 		
 		try
 		{
-			json receivedJson = json::parse(message);
+			std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+			InboundEvent inboundEvent;
+			inboundEvent.message = json::parse(message);
 			
-			std::string event = EPLJSONUtils::GetStringByName(receivedJson, kESDSDKCommonEvent);
-			std::string context = EPLJSONUtils::GetStringByName(receivedJson, kESDSDKCommonContext);
-			std::string action = EPLJSONUtils::GetStringByName(receivedJson, kESDSDKCommonAction);
-			std::string deviceID = EPLJSONUtils::GetStringByName(receivedJson, kESDSDKCommonDevice);
-			json payload;
-			EPLJSONUtils::GetObjectByName(receivedJson, kESDSDKCommonPayload, payload);
+			std::string event = EPLJSONUtils::MoveStringByName(inboundEvent.message, kESDSDKCommonEvent);
+			inboundEvent.context = EPLJSONUtils::MoveStringByName(inboundEvent.message, kESDSDKCommonContext);
+			inboundEvent.action = EPLJSONUtils::MoveStringByName(inboundEvent.message, kESDSDKCommonAction);
+			inboundEvent.deviceID = EPLJSONUtils::MoveStringByName(inboundEvent.message, kESDSDKCommonDevice);
+			EPLJSONUtils::MoveObjectByName(inboundEvent.message, kESDSDKCommonPayload, inboundEvent.payload);
+
+			std::chrono::steady_clock::time_point parsedTime = std::chrono::steady_clock::now();
 
-			if(event == kESDSDKEventKeyDown)
+			const std::unordered_map<std::string, InboundHandler>& handlers = GetInboundHandlers();
+			auto handlerIt = handlers.find(event);
+			if (handlerIt != handlers.end())
 			{
-				mPlugin->KeyDownForAction(action, context, payload, deviceID);
+				handlerIt->second(mPlugin, inboundEvent);
 			}
-			else if(event == kESDSDKEventKeyUp)
+
+			std::chrono::steady_clock::time_point handledTime = std::chrono::steady_clock::now();
+			uint64_t parseUs = std::chrono::duration_cast<std::chrono::microseconds>(parsedTime - startTime).count();
+			uint64_t handlerUs = std::chrono::duration_cast<std::chrono::microseconds>(handledTime - parsedTime).count();
+
+			std::lock_guard<std::mutex> lock(mInboundStatsMutex);
+			InboundEventStats& stats = mInboundStats[event];
+			stats.count++;
+			stats.parseUs += parseUs;
+			stats.handlerUs += handlerUs;
+			stats.maxHandlerUs = (std::max)(stats.maxHandlerUs, handlerUs);
+		}
+		catch (...)
+		{
+		}
+	}
+}
+
+const std::unordered_map<std::string, ESDConnectionManager::InboundHandler>& ESDConnectionManager::GetInboundHandlers()
+{
+	static const std::unordered_map<std::string, InboundHandler> handlers =
+	{
+		{ kESDSDKEventKeyDown, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
 			{
-				mPlugin->KeyUpForAction(action, context, payload, deviceID);
-			}
-			else if(event == kESDSDKEventWillAppear)
+				inPlugin->KeyDownForAction(inEvent.action, inEvent.context, inEvent.payload, inEvent.deviceID);
+			} },
+		{ kESDSDKEventKeyUp, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
 			{
-				mPlugin->WillAppearForAction(action, context, payload, deviceID);
-			}
-			else if(event == kESDSDKEventWillDisappear)
+				inPlugin->KeyUpForAction(inEvent.action, inEvent.context, inEvent.payload, inEvent.deviceID);
+			} },
+		{ kESDSDKEventWillAppear, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
 			{
-				mPlugin->WillDisappearForAction(action, context, payload, deviceID);
-			}
-			else if(event == kESDSDKEventDeviceDidConnect)
+				inPlugin->WillAppearForAction(inEvent.action, inEvent.context, inEvent.payload, inEvent.deviceID);
+			} },
+		{ kESDSDKEventWillDisappear, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
+			{
+				inPlugin->WillDisappearForAction(inEvent.action, inEvent.context, inEvent.payload, inEvent.deviceID);
+			} },
+		{ kESDSDKEventDeviceDidConnect, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
 			{
 				json deviceInfo;
-				EPLJSONUtils::GetObjectByName(receivedJson, kESDSDKCommonDeviceInfo, deviceInfo);
-				mPlugin->DeviceDidConnect(deviceID, deviceInfo);
-			}
-			else if(event == kESDSDKEventDeviceDidDisconnect)
+				EPLJSONUtils::MoveObjectByName(inEvent.message, kESDSDKCommonDeviceInfo, deviceInfo);
+				inPlugin->DeviceDidConnect(inEvent.deviceID, deviceInfo);
+			} },
+		{ kESDSDKEventDeviceDidDisconnect, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
 			{
-				mPlugin->DeviceDidDisconnect(deviceID);
-			}
-			else if (event == kESDSDKEventSendToPlugin)
+				inPlugin->DeviceDidDisconnect(inEvent.deviceID);
+			} },
+		{ kESDSDKEventSystemDidWakeUp, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
 			{
-				mPlugin->SendToPlugin(action, context, payload, deviceID);
-			}
-			else if (event == kESDSDKEventDidReceiveGlobalSettings)
+				inPlugin->SystemDidWakeUp();
+			} },
+		{ kESDSDKEventSendToPlugin, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
 			{
-				mPlugin->DidReceiveGlobalSettings(payload);
-			}
-		}
-		catch (...)
-		{
-		}
-	}
+				inPlugin->SendToPlugin(inEvent.action, inEvent.context, inEvent.payload, inEvent.deviceID);
+			} },
+		{ kESDSDKEventDidReceiveGlobalSettings, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
+			{
+				inPlugin->DidReceiveGlobalSettings(inEvent.payload);
+			} },
+		{ kESDSDKEventPropertyInspectorDidAppear, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
+			{
+				inPlugin->PropertyInspectorDidAppear(inEvent.action, inEvent.context, inEvent.deviceID);
+			} },
+		{ kESDSDKEventPropertyInspectorDidDisappear, [](ESDBasePlugin* inPlugin, InboundEvent& inEvent)
+			{
+				inPlugin->PropertyInspectorDidDisappear(inEvent.action, inEvent.context, inEvent.deviceID);
+			} },
+	};
+	return handlers;
+}
+
+std::map<std::string, ESDConnectionManager::InboundEventStats> ESDConnectionManager::GetInboundEventStats()
+{
+	std::lock_guard<std::mutex> lock(mInboundStatsMutex);
+	return std::map<std::string, InboundEventStats>(mInboundStats.begin(), mInboundStats.end());
 }
 
 ESDConnectionManager::ESDConnectionManager(
@@ -169,6 +221,7 @@ void ESDConnectionManager::Run()
 		// Start the ASIO io_service run loop
 		// this will cause a single connection to be made to the server. mWebsocket.run()
 		// will exit when this connection is closed.
+		mEventLoopThreadId = std::this_thread::get_id();
 		mWebsocket.run();
 	}
 	catch (websocketpp::exception const & e)
@@ -177,10 +230,21 @@ void ESDConnectionManager::Run()
 		(void)e;
 		DebugPrint("Websocket threw an exception: %s\n", e.what());
     }
+
+	// Nothing is sent anymore, don't let senders wait for room in the queue
+	CloseOutbound();
 }
 
 void ESDConnectionManager::SetTitle(const std::string &inTitle, const std::string& inContext, ESDSDKTarget inTarget)
 {
+	// Write the message straight into a reused buffer, it is sent often
+	thread_local std::string buffer;
+	if (ESDEventWriter::WriteSetTitle(buffer, inContext, inTitle, inTarget))
+	{
+		Enqueue(kESDSDKEventSetTitle, inContext, buffer, true);
+		return;
+	}
+
 	json jsonObject;
 
 	jsonObject[kESDSDKCommonEvent] = kESDSDKEventSetTitle;
@@ -191,12 +255,22 @@ void ESDConnectionManager::SetTitle(const std::string &inTitle, const std::strin
 	payload[kESDSDKPayloadTitle] = inTitle;
 	jsonObject[kESDSDKCommonPayload] = payload;
 	
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventSetTitle, inContext, jsonObject.dump(), true);
 }
 
 void ESDConnectionManager::SetImage(const std::string &inBase64ImageString, const std::string& inContext, ESDSDKTarget inTarget)
 {
+	const std::string prefix = "data:image/png;base64,";
+	bool hasPrefix = inBase64ImageString.empty() || inBase64ImageString.compare(0, prefix.length(), prefix) == 0;
+
+	// Write the message straight into a reused buffer, images are large
+	thread_local std::string buffer;
+	if (ESDEventWriter::WriteSetImage(buffer, inContext, prefix.c_str(), hasPrefix ? 0 : prefix.length(), inBase64ImageString, inTarget))
+	{
+		Enqueue(kESDSDKEventSetImage, inContext, buffer, true);
+		return;
+	}
+
 	json jsonObject;
 
 	jsonObject[kESDSDKCommonEvent] = kESDSDKEventSetImage;
@@ -204,15 +278,25 @@ void ESDConnectionManager::SetImage(const std::string &inBase64ImageString, cons
 
 	json payload;
 	payload[kESDSDKPayloadTarget] = inTarget;
-	const std::string prefix = "data:image/png;base64,";
-	if (inBase64ImageString.empty() || inBase64ImageString.substr(0, prefix.length()).find(prefix) == 0)
+	if (hasPrefix)
 		payload[kESDSDKPayloadImage] = inBase64ImageString;
 	else
-		payload[kESDSDKPayloadImage] = "data:image/png;base64," + inBase64ImageString;
+		payload[kESDSDKPayloadImage] = prefix + inBase64ImageString;
 	jsonObject[kESDSDKCommonPayload] = payload;
 	
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventSetImage, inContext, jsonObject.dump(), true);
+}
+
+void ESDConnectionManager::SetImage(const std::shared_ptr<const std::string>& inDataURI, const std::string& inContext, ESDSDKTarget inTarget)
+{
+	// The image is already a json string's content, only the parts around it are written,
+	// it is copied once into the websocket frame when sent
+	OutboundMessage message;
+	message.image = inDataURI;
+	if (inDataURI != nullptr && ESDEventWriter::WriteSetImageFragments(message.message, message.tail, inContext, inTarget))
+		Enqueue(kESDSDKEventSetImage, inContext, std::move(message), true);
+	else
+		SetImage(inDataURI != nullptr ? *inDataURI : std::string(), inContext, inTarget);
 }
 
 void ESDConnectionManager::ShowAlertForContext(const std::string& inContext)
@@ -222,8 +306,7 @@ void ESDConnectionManager::ShowAlertForContext(const std::string& inContext)
 	jsonObject[kESDSDKCommonEvent] = kESDSDKEventShowAlert;
 	jsonObject[kESDSDKCommonContext] = inContext;
 	
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventShowAlert, inContext, jsonObject.dump(), false);
 }
 
 void ESDConnectionManager::ShowOKForContext(const std::string& inContext)
@@ -233,8 +316,7 @@ void ESDConnectionManager::ShowOKForContext(const std::string& inContext)
 	jsonObject[kESDSDKCommonEvent] = kESDSDKEventShowOK;
 	jsonObject[kESDSDKCommonContext] = inContext;
 	
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventShowOK, inContext, jsonObject.dump(), false);
 }
 
 void ESDConnectionManager::GetGlobalSettings()
@@ -244,8 +326,7 @@ void ESDConnectionManager::GetGlobalSettings()
 	jsonObject[kESDSDKCommonEvent] = kESDSDKEventGetGlobalSettings;
 	jsonObject[kESDSDKCommonContext] = mPluginUUID;
 
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventGetGlobalSettings, mPluginUUID, jsonObject.dump(), false);
 }
 
 void ESDConnectionManager::SetGlobalSettings(const json &inSettings)
@@ -256,8 +337,7 @@ void ESDConnectionManager::SetGlobalSettings(const json &inSettings)
 	jsonObject[kESDSDKCommonContext] = mPluginUUID;
 	jsonObject[kESDSDKCommonPayload] = inSettings;
 	
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventSetGlobalSettings, mPluginUUID, jsonObject.dump(), true);
 }
 
 void ESDConnectionManager::SetSettings(const json& inSettings, const std::string& inContext)
@@ -268,8 +348,7 @@ void ESDConnectionManager::SetSettings(const json& inSettings, const std::string
 	jsonObject[kESDSDKCommonContext] = inContext;
 	jsonObject[kESDSDKCommonPayload] = inSettings;
 
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventSetSettings, inContext, jsonObject.dump(), true);
 }
 
 void ESDConnectionManager::SetState(int inState, const std::string& inContext)
@@ -283,8 +362,7 @@ void ESDConnectionManager::SetState(int inState, const std::string& inContext)
 	jsonObject[kESDSDKCommonContext] = inContext;
 	jsonObject[kESDSDKCommonPayload] = payload;
 	
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventSetState, inContext, jsonObject.dump(), true);
 }
 
 void ESDConnectionManager::SendToPropertyInspector(const std::string & inAction, const std::string & inContext, const json & inPayload)
@@ -296,8 +374,7 @@ void ESDConnectionManager::SendToPropertyInspector(const std::string & inAction,
 	jsonObject[kESDSDKCommonAction] = inAction;
 	jsonObject[kESDSDKCommonPayload] = inPayload;
 
-	websocketpp::lib::error_code ec;
-	mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+	Enqueue(kESDSDKEventSendToPropertyInspector, inContext, jsonObject.dump(), false);
 }
 
 void ESDConnectionManager::SwitchToProfile(const std::string& inDeviceID, const std::string& inProfileName)
@@ -317,8 +394,7 @@ void ESDConnectionManager::SwitchToProfile(const std::string& inDeviceID, const
 			jsonObject[kESDSDKCommonPayload] = payload;
 		}
 
-		websocketpp::lib::error_code ec;
-		mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+		Enqueue(kESDSDKEventSwitchToProfile, mPluginUUID, jsonObject.dump(), false);
 	}
 }
 
@@ -334,8 +410,7 @@ void ESDConnectionManager::LogMessage(const std::string& inMessage)
 		payload[kESDSDKPayloadMessage] = inMessage;
 		jsonObject[kESDSDKCommonPayload] = payload;
 
-		websocketpp::lib::error_code ec;
-		mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+		Enqueue(kESDSDKEventLogMessage, "", jsonObject.dump(), false);
 	}
 }
 
@@ -351,7 +426,133 @@ void ESDConnectionManager::OpenUrl(const std::string& inMessage)
 		payload[kESDSDKPayloadURL] = inMessage;
 		jsonObject[kESDSDKCommonPayload] = payload;
 
+		Enqueue(kESDSDKEventOpenURL, "", jsonObject.dump(), false);
+	}
+}
+
+void ESDConnectionManager::PostToEventLoop(const std::function<void()>& inFunction)
+{
+	mWebsocket.get_io_service().post(inFunction);
+}
+
+ESDConnectionManager::OutboundQueueStats ESDConnectionManager::GetOutboundQueueStats()
+{
+	std::lock_guard<std::mutex> lock(mOutboundMutex);
+	OutboundQueueStats stats = mOutboundStats;
+	stats.depth = mOutbound.size();
+	return stats;
+}
+
+void ESDConnectionManager::Enqueue(const std::string& inEvent, const std::string& inContext, std::string inMessage, bool inCoalesce)
+{
+	OutboundMessage message;
+	message.message = std::move(inMessage);
+	Enqueue(inEvent, inContext, std::move(message), inCoalesce);
+}
+
+void ESDConnectionManager::Enqueue(const std::string& inEvent, const std::string& inContext, OutboundMessage&& inMessage, bool inCoalesce)
+{
+	std::unique_lock<std::mutex> lock(mOutboundMutex);
+
+	const std::string key = inCoalesce ? inEvent + "\n" + inContext : "";
+	bool hasWaited = false;
+	while (!mIsOutboundClosed)
+	{
+		// A newer message for the same context and event replaces the queued one in place
+		if (!key.empty())
+		{
+			auto it = mOutboundByKey.find(key);
+			if (it != mOutboundByKey.end())
+			{
+				inMessage.key = key;
+				*it->second = std::move(inMessage);
+				mOutboundStats.coalesced++;
+				return;
+			}
+		}
+
+		if (mOutbound.size() < kOutboundQueueCapacity || hasWaited)
+			break;
+
+		if (std::this_thread::get_id() == mEventLoopThreadId)
+		{
+			// The event loop can't wait for itself to drain the queue, send what is queued now
+			lock.unlock();
+			DrainOutbound();
+			lock.lock();
+		}
+		else
+		{
+			// Wait for the event loop to catch up. The wait is bounded since the sender may hold a
+			// lock that a handler on the event loop is waiting for, after that the queue grows past its capacity
+			mOutboundStats.blocked++;
+			mOutboundCondition.wait_for(lock, std::chrono::milliseconds(100),
+				[this]() { return mIsOutboundClosed || mOutbound.size() < kOutboundQueueCapacity; });
+			hasWaited = true;
+		}
+	}
+
+	if (mIsOutboundClosed)
+		return;
+
+	inMessage.key = key;
+	mOutbound.push_back(std::move(inMessage));
+	if (!key.empty())
+		mOutboundByKey[key] = std::prev(mOutbound.end());
+	mOutboundStats.maxDepth = (std::max)(mOutboundStats.maxDepth, mOutbound.size());
+
+	// One drain at a time is enough, it sends everything queued when it runs
+	if (!mIsDrainPosted)
+	{
+		mIsDrainPosted = true;
+		mWebsocket.get_io_service().post([this]() { DrainOutbound(); });
+	}
+}
+
+void ESDConnectionManager::DrainOutbound()
+{
+	// Runs on the event loop thread, the only thread that writes to the websocket
+	std::list<OutboundMessage> messages;
+	{
+		std::lock_guard<std::mutex> lock(mOutboundMutex);
+		messages.swap(mOutbound);
+		mOutboundByKey.clear();
+		mIsDrainPosted = false;
+	}
+	mOutboundCondition.notify_all();
+
+	for (const auto& message : messages)
+	{
 		websocketpp::lib::error_code ec;
-		mWebsocket.send(mConnectionHandle, jsonObject.dump(), websocketpp::frame::opcode::text, ec);
+		if (message.image == nullptr)
+		{
+			mWebsocket.send(mConnectionHandle, message.message, websocketpp::frame::opcode::text, ec);
+			continue;
+		}
+
+		// Assemble the parts straight into the frame's payload
+		WebsocketClient::connection_ptr connection = mWebsocket.get_con_from_hdl(mConnectionHandle, ec);
+		if (ec)
+			continue;
+		message_ptr frame = connection->get_message(websocketpp::frame::opcode::text,
+			message.message.size() + message.image->size() + message.tail.size());
+		frame->append_payload(message.message.data(), message.message.size());
+		frame->append_payload(message.image->data(), message.image->size());
+		frame->append_payload(message.tail.data(), message.tail.size());
+		mWebsocket.send(mConnectionHandle, frame, ec);
+	}
+
+	std::lock_guard<std::mutex> lock(mOutboundMutex);
+	mOutboundStats.sent += messages.size();
+}
+
+void ESDConnectionManager::CloseOutbound()
+{
+	{
+		std::lock_guard<std::mutex> lock(mOutboundMutex);
+		mIsOutboundClosed = true;
+		mOutbound.clear();
+		mOutboundByKey.clear();
 	}
+	mOutboundCondition.notify_all();
 }
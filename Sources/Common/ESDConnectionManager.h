@@ -20,6 +20,14 @@
 #include <websocketpp/common/thread.hpp>
 #include <websocketpp/common/memory.hpp>
 
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+
 typedef websocketpp::config::asio_client::message_type::ptr message_ptr;
 typedef websocketpp::client<websocketpp::config::asio_client> WebsocketClient;
 
@@ -40,6 +48,7 @@ public:
 	// API to communicate with the Stream Deck application
 	void SetTitle(const std::string &inTitle, const std::string& inContext, ESDSDKTarget inTarget);
 	void SetImage(const std::string &inBase64ImageString, const std::string& inContext, ESDSDKTarget inTarget);
+	void SetImage(const std::shared_ptr<const std::string>& inDataURI, const std::string& inContext, ESDSDKTarget inTarget);
 	void ShowAlertForContext(const std::string& inContext);
 	void ShowOKForContext(const std::string& inContext);
 	void SetSettings(const json &inSettings, const std::string& inContext);
@@ -51,6 +60,30 @@ public:
 	void LogMessage(const std::string& inMessage);
 	void OpenUrl(const std::string& inMessage);
 
+	// Run a function on the event loop thread, used to hand back results of background work
+	void PostToEventLoop(const std::function<void()>& inFunction);
+
+	// Counters of the outbound message queue
+	struct OutboundQueueStats
+	{
+		size_t depth = 0; // messages waiting to be sent
+		size_t maxDepth = 0; // most messages that have been waiting at once
+		uint64_t sent = 0;
+		uint64_t coalesced = 0; // messages replaced by a newer one for the same context and event
+		uint64_t blocked = 0; // times a sender waited for the queue to have room
+	};
+	OutboundQueueStats GetOutboundQueueStats();
+
+	// Counters of the inbound messages of one event
+	struct InboundEventStats
+	{
+		uint64_t count = 0;
+		uint64_t parseUs = 0; // total time parsing the messages
+		uint64_t handlerUs = 0; // total time in the plugin's handlers, 0 for events without one
+		uint64_t maxHandlerUs = 0;
+	};
+	std::map<std::string, InboundEventStats> GetInboundEventStats();
+
 private:
 	
 	// Websocket callbacks
@@ -58,6 +91,31 @@ private:
 	void OnFail(WebsocketClient * inClient, websocketpp::connection_hdl inConnectionHandler);
 	void OnClose(WebsocketClient * inClient, websocketpp::connection_hdl inConnectionHandler);
 	void OnMessage(websocketpp::connection_hdl, WebsocketClient::message_ptr inMsg);
+
+	// Inbound dispatch, the fields of a message are moved out of the parsed json and handed to the handler
+	struct InboundEvent
+	{
+		json message;
+		std::string action;
+		std::string context;
+		std::string deviceID;
+		json payload;
+	};
+	typedef void (*InboundHandler)(ESDBasePlugin* inPlugin, InboundEvent& inEvent);
+	static const std::unordered_map<std::string, InboundHandler>& GetInboundHandlers();
+
+	// Outbound queue, every message is sent from the event loop thread
+	struct OutboundMessage
+	{
+		std::string key; // event and context for messages that can be coalesced, empty otherwise
+		std::string message;
+		std::shared_ptr<const std::string> image; // shared image sent between message and tail, not copied until sent
+		std::string tail;
+	};
+	void Enqueue(const std::string& inEvent, const std::string& inContext, std::string inMessage, bool inCoalesce);
+	void Enqueue(const std::string& inEvent, const std::string& inContext, OutboundMessage&& inMessage, bool inCoalesce);
+	void DrainOutbound();
+	void CloseOutbound();
 	
 	// Member variables
 	int mPort = 0;
@@ -66,5 +124,18 @@ private:
 	websocketpp::connection_hdl mConnectionHandle;
 	WebsocketClient mWebsocket;
 	ESDBasePlugin * mPlugin = nullptr;
+
+	static const size_t kOutboundQueueCapacity = 256;
+	std::mutex mOutboundMutex;
+	std::condition_variable mOutboundCondition;
+	std::list<OutboundMessage> mOutbound;
+	std::unordered_map<std::string, std::list<OutboundMessage>::iterator> mOutboundByKey;
+	bool mIsDrainPosted = false;
+	bool mIsOutboundClosed = false;
+	std::thread::id mEventLoopThreadId;
+	OutboundQueueStats mOutboundStats;
+
+	std::mutex mInboundStatsMutex;
+	std::unordered_map<std::string, InboundEventStats> mInboundStats;
 };
 
@@ -0,0 +1,188 @@
+//==============================================================================
+/**
+@file       ESDEventWriter.h
+
+@brief		Writes the fixed-shape setTitle and setImage events straight into a string,
+			with the same bytes json::dump() produces for them
+
+@copyright  (c) 2020, Momoko Tomoko
+
+**/
+//==============================================================================
+
+#pragma once
+
+//------------------------------------------------------------------------------
+// Includes
+//------------------------------------------------------------------------------
+
+#include "ESDSDKDefines.h"
+
+#include <charconv>
+#include <string>
+
+class ESDEventWriter
+{
+
+public:
+
+	//! Write {"context":...,"event":"setTitle","payload":{"target":...,"title":...}} into outBuffer.
+	//! Returns false if a string is not valid UTF-8, json::dump() throws for those.
+	static bool WriteSetTitle(std::string& outBuffer, const std::string& inContext, const std::string& inTitle, ESDSDKTarget inTarget)
+	{
+		outBuffer.clear();
+		outBuffer.append("{\"" kESDSDKCommonContext "\":");
+		if (!AppendString(outBuffer, inContext, "", 0))
+			return false;
+		outBuffer.append(",\"" kESDSDKCommonEvent "\":\"" kESDSDKEventSetTitle "\",\"" kESDSDKCommonPayload "\":{\"" kESDSDKPayloadTarget "\":");
+		AppendInt(outBuffer, inTarget);
+		outBuffer.append(",\"" kESDSDKPayloadTitle "\":");
+		if (!AppendString(outBuffer, inTitle, "", 0))
+			return false;
+		outBuffer.append("}}");
+		return true;
+	}
+
+	//! Write {"context":...,"event":"setImage","payload":{"image":prefix+image,"target":...}} into outBuffer.
+	//! Returns false if a string is not valid UTF-8, json::dump() throws for those.
+	static bool WriteSetImage(std::string& outBuffer, const std::string& inContext, const char* inImagePrefix, size_t inImagePrefixLength,
+		const std::string& inImage, ESDSDKTarget inTarget)
+	{
+		outBuffer.clear();
+		outBuffer.reserve(inImagePrefixLength + inImage.size() + inContext.size() + 96);
+		outBuffer.append("{\"" kESDSDKCommonContext "\":");
+		if (!AppendString(outBuffer, inContext, "", 0))
+			return false;
+		outBuffer.append(",\"" kESDSDKCommonEvent "\":\"" kESDSDKEventSetImage "\",\"" kESDSDKCommonPayload "\":{\"" kESDSDKPayloadImage "\":");
+		if (!AppendString(outBuffer, inImage, inImagePrefix, inImagePrefixLength))
+			return false;
+		outBuffer.append(",\"" kESDSDKPayloadTarget "\":");
+		AppendInt(outBuffer, inTarget);
+		outBuffer.append("}}");
+		return true;
+	}
+
+	//! Write the setImage event around an image that is already a json string's content, such as a data URI:
+	//! outHead + image + outTail is the message. Returns false if the context is not valid UTF-8.
+	static bool WriteSetImageFragments(std::string& outHead, std::string& outTail, const std::string& inContext, ESDSDKTarget inTarget)
+	{
+		outHead.clear();
+		outHead.append("{\"" kESDSDKCommonContext "\":");
+		if (!AppendString(outHead, inContext, "", 0))
+			return false;
+		outHead.append(",\"" kESDSDKCommonEvent "\":\"" kESDSDKEventSetImage "\",\"" kESDSDKCommonPayload "\":{\"" kESDSDKPayloadImage "\":\"");
+
+		outTail.clear();
+		outTail.append("\",\"" kESDSDKPayloadTarget "\":");
+		AppendInt(outTail, inTarget);
+		outTail.append("}}");
+		return true;
+	}
+
+private:
+
+	//! Append prefix + inString as a quoted json string, escaped like json::dump() with ensure_ascii off
+	static bool AppendString(std::string& outBuffer, const std::string& inString, const char* inPrefix, size_t inPrefixLength)
+	{
+		outBuffer.push_back('"');
+		if (!AppendEscaped(outBuffer, inPrefix, inPrefixLength) || !AppendEscaped(outBuffer, inString.data(), inString.size()))
+			return false;
+		outBuffer.push_back('"');
+		return true;
+	}
+
+	static bool AppendEscaped(std::string& outBuffer, const char* inData, size_t inSize)
+	{
+		static const char kHex[] = "0123456789abcdef";
+		const unsigned char* data = reinterpret_cast<const unsigned char*>(inData);
+
+		// Copy runs of characters that need no escaping in one go
+		size_t runStart = 0;
+		size_t i = 0;
+		while (i < inSize)
+		{
+			unsigned char c = data[i];
+			if (c >= 0x20 && c != '"' && c != '\\' && c < 0x80)
+			{
+				i++;
+				continue;
+			}
+
+			outBuffer.append(inData + runStart, i - runStart);
+
+			if (c >= 0x80)
+			{
+				// Multi-byte characters are copied as they are once they are known to be valid
+				size_t length = ValidUTF8Length(data + i, inSize - i);
+				if (length == 0)
+					return false;
+				outBuffer.append(inData + i, length);
+				i += length;
+				runStart = i;
+				continue;
+			}
+
+			switch (c)
+			{
+				case '"': outBuffer.append("\\\""); break;
+				case '\\': outBuffer.append("\\\\"); break;
+				case '\b': outBuffer.append("\\b"); break;
+				case '\f': outBuffer.append("\\f"); break;
+				case '\n': outBuffer.append("\\n"); break;
+				case '\r': outBuffer.append("\\r"); break;
+				case '\t': outBuffer.append("\\t"); break;
+				default:
+				{
+					const char escaped[] = { '\\', 'u', '0', '0', kHex[c >> 4], kHex[c & 0xF] };
+					outBuffer.append(escaped, sizeof(escaped));
+					break;
+				}
+			}
+			i++;
+			runStart = i;
+		}
+		outBuffer.append(inData + runStart, inSize - runStart);
+		return true;
+	}
+
+	//! Length of the UTF-8 sequence at inData, 0 if it is not a valid one (overlong, surrogate, above U+10FFFF or cut off)
+	static size_t ValidUTF8Length(const unsigned char* inData, size_t inSize)
+	{
+		unsigned char c = inData[0];
+		size_t length = 0;
+		unsigned char low = 0x80;
+		unsigned char high = 0xBF;
+		if (c >= 0xC2 && c <= 0xDF)
+			length = 2;
+		else if (c >= 0xE0 && c <= 0xEF)
+		{
+			length = 3;
+			if (c == 0xE0) low = 0xA0;
+			if (c == 0xED) high = 0x9F;
+		}
+		else if (c >= 0xF0 && c <= 0xF4)
+		{
+			length = 4;
+			if (c == 0xF0) low = 0x90;
+			if (c == 0xF4) high = 0x8F;
+		}
+		else
+			return 0;
+
+		if (inSize < length || inData[1] < low || inData[1] > high)
+			return 0;
+		for (size_t i = 2; i < length; i++)
+		{
+			if (inData[i] < 0x80 || inData[i] > 0xBF)
+				return 0;
+		}
+		return length;
+	}
+
+	static void AppendInt(std::string& outBuffer, int inValue)
+	{
+		char digits[16];
+		std::to_chars_result result = std::to_chars(digits, digits + sizeof(digits), inValue);
+		outBuffer.append(digits, result.ptr - digits);
+	}
+};
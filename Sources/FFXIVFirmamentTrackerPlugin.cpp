@@ -15,10 +15,13 @@
 #include "Windows/FirmamentTrackerHelper.h"
 #include "Windows/CallBackTimer.h"
 #include "Windows/StreamDeckImageManager.h"
+#include "Windows/AdaptivePoller.h"
 
 #include "Common/ESDConnectionManager.h"
 
 //#define LOGGING
+#define USE_ADAPTIVE_POLLING // read around the learned publication time instead of at minute 1 of every hour
+#define USE_PROGRESS_IMAGE // draw the progress bar and level over the button's icon
 
 FFXIVFirmamentTrackerPlugin::FFXIVFirmamentTrackerPlugin()
 {
@@ -34,39 +37,113 @@ FFXIVFirmamentTrackerPlugin::~FFXIVFirmamentTrackerPlugin()
 
 /**
 	@brief Starts the callback timers for this plugin
+
+	@param[in] isReadNow read the page right away, otherwise wait for the next scheduled read
 **/
-void FFXIVFirmamentTrackerPlugin::startTimers()
+void FFXIVFirmamentTrackerPlugin::startTimers(bool isReadNow)
 {
-	mTimer->stop();
+	stopTimers();
 
     #ifdef LOGGING
 	mConnectionManager->LogMessage("Starting timers...");
     #endif
 
-	// timer that is called every hour on the 1 minute mark to grab raw html
-	std::set<int> triggerMinuteOfTheHour = { 1 };
-	mTimer->start(triggerMinuteOfTheHour, [this]()
+	// failed reads back off, show it on the buttons when the breaker opens or closes
+	mTimer->getRetryPolicy().setOnStateChange([this](RetryPolicy::breakerState_t state)
+		{
+			mConnectionManager->PostToEventLoop([this, state]()
+				{
+					mConnectionManager->LogMessage(std::string("Firmament read circuit breaker is ") + RetryPolicy::toString(state) +
+						", failures in a row: " + std::to_string(mTimer->getRetryPolicy().getFailureCount()));
+
+					mVisibleContextsMutex.lock();
+					for (const auto& context : mContextServerMap)
+						this->UpdateUI(context.first);
+					mVisibleContextsMutex.unlock();
+				});
+		});
+
+	std::function<bool(void)> readAndUpdate = [this]()
 		{
             #ifdef LOGGING
 			mConnectionManager->LogMessage("Reading HTML...");
             #endif
 
-			// read HTML and update UI once triggered
+			// copy the url so the lock is not held during the download, the buttons keep
+			// showing the last read until the new one is done
 			mVisibleContextsMutex.lock();
-			for (const auto& context : mContextServerMap)
-				mConnectionManager->SetTitle(context.second.server + "\nLoading", context.first, kESDSDKTarget_HardwareAndSoftware);
+			std::string url = mUrl;
+			mVisibleContextsMutex.unlock();
+
+			// read and parse HTML without the lock, handlers keep running meanwhile
+			bool isSuccess = mFirmamentTrackerHelper->readFirmamentHTML(url);
 
-			bool isSuccess = mFirmamentTrackerHelper->readFirmamentHTML(mUrl);
+			// update the UI of the contexts visible now, the map may have changed during the read
+			mVisibleContextsMutex.lock();
+			if (isSuccess && url == mUrl)
+			{
+				mAdaptivePoller->recordRead(mFirmamentTrackerHelper->getSnapshot()->contentHash);
+				mLastReadTime = time(0);
+			}
 
 			for (const auto& context : mContextServerMap)
 				this->UpdateUI(context.first);
+
+			// first read of a new url, send the server menu to the property inspectors
+			if (mFirstRead && url == mUrl)
+			{
+				json settings = buildGlobalSettings(url);
+				if (isSuccess)
+					mFirstRead = false;
+
+				// hand the result back to the event loop thread
+				mConnectionManager->PostToEventLoop([this, settings]()
+					{
+						std::lock_guard<std::mutex> lock(mVisibleContextsMutex);
+						publishGlobalSettings(settings);
+					});
+			}
 			mVisibleContextsMutex.unlock();
 
             #ifdef LOGGING
-			mConnectionManager->LogMessage("Reading status: " + std::to_string(status));
+			mConnectionManager->LogMessage("Reading status: " + std::to_string(isSuccess));
+			mConnectionManager->LogMessage("Fetch stats: " + CurlFetchClient::formatStats(mFirmamentTrackerHelper->getFetchStats()));
+			mConnectionManager->LogMessage("Handler latency: " + mHandlerLatency.format());
+			mConnectionManager->LogMessage("Polling: " + mAdaptivePoller->format());
+			mConnectionManager->LogMessage("Image atlas: " + StreamDeckImageManager::formatAtlasStats(mStreamDeckImageManager->getAtlasStats()));
+			ESDConnectionManager::OutboundQueueStats queueStats = mConnectionManager->GetOutboundQueueStats();
+			mConnectionManager->LogMessage("Outbound queue: depth " + std::to_string(queueStats.depth) +
+				", max depth " + std::to_string(queueStats.maxDepth) + ", sent " + std::to_string(queueStats.sent) +
+				", coalesced " + std::to_string(queueStats.coalesced) + ", blocked " + std::to_string(queueStats.blocked));
+			for (const auto& inbound : mConnectionManager->GetInboundEventStats())
+				mConnectionManager->LogMessage("Inbound " + inbound.first + ": count " + std::to_string(inbound.second.count) +
+					", parse " + std::to_string(inbound.second.parseUs) + "us, handler " + std::to_string(inbound.second.handlerUs) +
+					"us, max handler " + std::to_string(inbound.second.maxHandlerUs) + "us");
             #endif
 			return isSuccess;
-		});
+		};
+
+#ifdef USE_ADAPTIVE_POLLING
+	// timer that reads around the time the page is published, learned from when its content changes
+	mPollJob = mTimer->start([this]() { return mAdaptivePoller->getNextDeadline(); }, readAndUpdate, isReadNow);
+#else
+	// timer that is called every hour on the 1 minute mark to grab raw html
+	std::set<int> triggerMinuteOfTheHour = { 1 };
+	mPollJob = mTimer->start(triggerMinuteOfTheHour, readAndUpdate, isReadNow);
+#endif
+}
+
+/**
+	@brief Cancels the read job without waiting for it. A read in progress finishes on the
+	timer thread but is not scheduled again, only the destructor joins the thread.
+**/
+void FFXIVFirmamentTrackerPlugin::stopTimers()
+{
+	if (mPollJob == CallBackTimer::INVALID_JOB)
+		return;
+
+	mTimer->cancel(mPollJob);
+	mPollJob = CallBackTimer::INVALID_JOB;
 }
 
 /**
@@ -78,35 +155,43 @@ void FFXIVFirmamentTrackerPlugin::UpdateUI(const std::string& inContext)
 
 	if(mConnectionManager != nullptr)
 	{
-		bool isSuccessful = true;
 		// go through all our visible contexts and set the title to show the firmament progress
 		if (mContextServerMap.find(inContext) != mContextServerMap.end())
 		{
-			if (mContextServerMap.at(inContext).server.length() > 0)
+			const contextMetaData_t& metadata = mContextServerMap.at(inContext);
+			if (metadata.server.length() > 0)
 			{
-				FirmamentTrackerHelper::restorationServerStatus_t status = mFirmamentTrackerHelper->getFirmamentStatus(mContextServerMap.at(inContext).server);
+				FirmamentTrackerHelper::restorationServerStatus_t status = mFirmamentTrackerHelper->getFirmamentStatus(metadata.server);
+
+				// reads keep failing and are paused for a while
+				RetryPolicy::breakerState_t breakerState = mTimer->getRetryPolicy().getState();
+				if (!status.isValid && breakerState != RetryPolicy::breakerState_t::CLOSED)
+					status.progress = "Offline";
 
 				// Server name \n progress%
-				mConnectionManager->SetTitle(mContextServerMap.at(inContext).server + "\n" + status.progress, inContext, kESDSDKTarget_HardwareAndSoftware);
+				sendTitleIfChanged(metadata.server + "\n" + status.progress, inContext);
+
+				// icon with the progress drawn over it, the plain icon until there is progress to show
+#ifdef USE_PROGRESS_IMAGE
+				if (status.isValid)
+					sendImageIfChanged(mStreamDeckImageManager->getProgressImage(metadata.imageName, status.progressF, status.level), inContext);
+				else
+#endif
+					sendImageIfChanged(mStreamDeckImageManager->getImage(metadata.imageName), inContext);
 
 				json j;
 				j["FirmamentStatus"]["isValid"] = status.isValid;
 				j["FirmamentStatus"]["level"] = status.level;
 				j["FirmamentStatus"]["progress"] = std::to_string(status.progressF);
 				j["FirmamentStatus"]["text"] = status.text;
-				mConnectionManager->SendToPropertyInspector("", inContext, j);
+				j["FirmamentStatus"]["breaker"] = RetryPolicy::toString(breakerState);
+				sendToPropertyInspectorIfChanged(j, inContext);
 			}
 			else
-				mConnectionManager->SetTitle("", inContext, kESDSDKTarget_HardwareAndSoftware);
-		}
-
-		// re-load html if something failed
-		if (!isSuccessful)
-		{
-			#ifdef LOGGING
-			mConnectionManager->LogMessage("Something went wrong parsing progress percentage from HTML, attempt reloading page...");
-			#endif
-			mTimer->wake();
+			{
+				sendTitleIfChanged("", inContext);
+				sendImageIfChanged(mStreamDeckImageManager->getImage(metadata.imageName), inContext);
+			}
 		}
 	}
 }
@@ -114,6 +199,8 @@ void FFXIVFirmamentTrackerPlugin::UpdateUI(const std::string& inContext)
 
 void FFXIVFirmamentTrackerPlugin::KeyDownForAction(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
 {
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
 	mVisibleContextsMutex.lock();
 	std::string url = mContextServerMap.at(inContext).onClickUrl;
 	mVisibleContextsMutex.unlock();
@@ -161,6 +248,8 @@ FFXIVFirmamentTrackerPlugin::contextMetaData_t FFXIVFirmamentTrackerPlugin::read
 **/
 void FFXIVFirmamentTrackerPlugin::WillAppearForAction(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
 {
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
 	// read payload for any saved settings
 	contextMetaData_t data{};
 	if (inPayload.find("settings") != inPayload.end())
@@ -179,23 +268,17 @@ void FFXIVFirmamentTrackerPlugin::WillAppearForAction(const std::string& inActio
 		mStreamDeckImageManager->loadAllPng();
 	}
 
-	// set plugin image
-	mConnectionManager->SetImage(mStreamDeckImageManager->getImage(data.imageName), inContext, 0);
-
-	// if this is the first plugin to be displayed, boot up the timers
-	bool isEmpty = mContextServerMap.empty();
-	if (isEmpty)
-		startTimers();
-
-	// Remember the context and the saved metadata
+	// Remember the context and the saved metadata, the device it is on is connected
 	mContextServerMap.insert({ inContext, data });
+	if (inDeviceID.length() > 0)
+		mConnectedDevices.insert(inDeviceID);
 
-	// update the UI with firmament percentages
-	if (!isEmpty)
-	{
-		this->UpdateUI(inContext);
-	}
+	// update the UI with firmament percentages and set the image, shows "Loading" until the first read is done
+	this->UpdateUI(inContext);
 	mVisibleContextsMutex.unlock();
+
+	// if this is the first plugin to be displayed, boot up the timers
+	updatePolling();
 }
 
 /**
@@ -203,26 +286,94 @@ void FFXIVFirmamentTrackerPlugin::WillAppearForAction(const std::string& inActio
 **/
 void FFXIVFirmamentTrackerPlugin::WillDisappearForAction(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
 {
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
 	// Remove this particular context so we don't have to process it when updating UI
 	mVisibleContextsMutex.lock();
 	mContextServerMap.erase(inContext);
+	mSentState.erase(inContext);
+	mVisibleContextsMutex.unlock();
 
 	// if we have no active plugin displayed, kill the timers to save cpu cycles
-	if (mContextServerMap.empty())
-	{
-		mTimer->stop();
-	}
-	mVisibleContextsMutex.unlock();
+	updatePolling();
 }
 
+/**
+	@brief Runs when a device is plugged in, resumes polling if it shows a context
+**/
 void FFXIVFirmamentTrackerPlugin::DeviceDidConnect(const std::string& inDeviceID, const json &inDeviceInfo)
 {
-	// Nothing to do
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
+	mVisibleContextsMutex.lock();
+	mConnectedDevices.insert(inDeviceID);
+	mVisibleContextsMutex.unlock();
+
+	updatePolling();
 }
 
+/**
+	@brief Runs when a device is unplugged, pauses polling once no device is left
+**/
 void FFXIVFirmamentTrackerPlugin::DeviceDidDisconnect(const std::string& inDeviceID)
 {
-	// Nothing to do
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
+	mVisibleContextsMutex.lock();
+	mConnectedDevices.erase(inDeviceID);
+	mVisibleContextsMutex.unlock();
+
+	updatePolling();
+}
+
+/**
+	@brief Runs when the computer wakes from sleep. The timer's wait for the next read may be off
+	after sleeping, so schedule it again from the wall clock and read right away if the page
+	has been published since the last read.
+**/
+void FFXIVFirmamentTrackerPlugin::SystemDidWakeUp()
+{
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
+	mVisibleContextsMutex.lock();
+	bool isPolling = mIsPolling;
+	bool isStale = mAdaptivePoller->isPublishedSince(mLastReadTime);
+	mVisibleContextsMutex.unlock();
+
+	// polling resumes with the same check when a context or device shows up
+	if (!isPolling)
+		return;
+
+	#ifdef LOGGING
+	mConnectionManager->LogMessage(std::string("Woke up, data is ") + (isStale ? "stale" : "current"));
+	#endif
+
+	// replace the read job, a read in progress is not waited for
+	startTimers(isStale);
+}
+
+/**
+	@brief Starts or stops polling so it only runs while a context is shown on a connected device,
+	resuming reads right away only if the page has been published since the last read
+**/
+void FFXIVFirmamentTrackerPlugin::updatePolling()
+{
+	// warning: don't lock mVisibleContextsMutex before calling, it is locked here
+
+	mVisibleContextsMutex.lock();
+	bool shouldPoll = !mContextServerMap.empty() && !mConnectedDevices.empty();
+	bool isChanged = shouldPoll != mIsPolling;
+	mIsPolling = shouldPoll;
+	bool isStale = mAdaptivePoller->isPublishedSince(mLastReadTime);
+	mVisibleContextsMutex.unlock();
+
+	if (!isChanged)
+		return;
+
+	if (shouldPoll)
+		startTimers(isStale);
+	else
+		stopTimers();
 }
 
 /**
@@ -230,6 +381,8 @@ void FFXIVFirmamentTrackerPlugin::DeviceDidDisconnect(const std::string& inDevic
 **/
 void FFXIVFirmamentTrackerPlugin::SendToPlugin(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID)
 {
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
 	mVisibleContextsMutex.lock();
 	// PI dropdown menu has saved new settings for this context, load those
 	if (mContextServerMap.find(inContext) != mContextServerMap.end())
@@ -237,7 +390,12 @@ void FFXIVFirmamentTrackerPlugin::SendToPlugin(const std::string& inAction, cons
 		// updated stored settings
 		contextMetaData_t metadata = readJsonIntoMetaData(inPayload);
 		mContextServerMap.at(inContext) = metadata;
-		mConnectionManager->SetImage(mStreamDeckImageManager->getImage(metadata.imageName), inContext, 0);
+
+		// the PI sends its settings when it loads, it is open and needs the status again
+		// in case it wasn't connected yet when it appeared
+		sentState_t& sent = mSentState[inContext];
+		sent.isPropertyInspectorOpen = true;
+		sent.propertyInspectorPayload.clear();
 	}
 	else
 	{
@@ -245,82 +403,232 @@ void FFXIVFirmamentTrackerPlugin::SendToPlugin(const std::string& inAction, cons
 		mConnectionManager->LogMessage(inContext);
 	}
 
-	// update UI after changing server for this app
+	// update UI and image after changing server for this app
 	this->UpdateUI(inContext);
 
 	mVisibleContextsMutex.unlock();
 }
 
 /**
-	@brief Runs when app recieves global settings
+	@brief Builds the global settings: the firmament url, the server menu from the last read, and the image list
+
+	@param[in] url the firmament url that was read
+
+	@return the global settings
 **/
-void FFXIVFirmamentTrackerPlugin::DidReceiveGlobalSettings(const json& inPayload)
+json FFXIVFirmamentTrackerPlugin::buildGlobalSettings(const std::string& url)
 {
-	mVisibleContextsMutex.lock();
-	// check for change in firmament website
-	json j = inPayload["settings"];
-	if (j.find("FirmamentUrl") != j.end())
-	{
-		std::string url = j["FirmamentUrl"].get<std::string>();
-		if (url != mUrl)
-		{
-			mUrl = url;
-			mFirstRead = true;
-		}
-	}
+	json j;
+	j["FirmamentUrl"] = url;
 
-	// do a test read, reload global settings
-	if (mFirstRead) // only do this once per new url
+	std::shared_ptr<const FirmamentTrackerHelper::snapshot_t> snapshot = mFirmamentTrackerHelper->getSnapshot();
+	if (snapshot->isSuccess)
 	{
-		json j;
-		j["FirmamentUrl"] = mUrl;
-
-		// send hierarchy
-		bool isSuccess = mFirmamentTrackerHelper->readFirmamentHTML(mUrl);
-		if (isSuccess)
+		// generate the hierarchy and send as global setting
+		for (const auto& region : snapshot->serverHierarchy)
 		{
-			if (mFirmamentTrackerHelper->isHtmlGood())
+			for (const auto& dc : region.dc)
 			{
-				// generate the hierarchy and send as global setting
-				std::vector<FirmamentTrackerHelper::restorationRegion_t> serverHierarchy = mFirmamentTrackerHelper->getServerHierarchy();
-				for (const auto region : serverHierarchy)
+				for (const auto& server : dc.second.servers)
 				{
-					for (const auto dc : region.dc)
-					{
-						for (const auto server : dc.second.servers)
-						{
-							j["menu"][region.name][dc.first] += server;
-						}
-					}
+					j["menu"][region.name][dc.first] += server;
 				}
-				
-                #ifdef LOGGING
-				mConnectionManager->LogMessage(j.dump(4));
-                #endif
-
-				mFirstRead = false;
 			}
 		}
 
-		// send list of images
-		std::set <std::string> imageList = mStreamDeckImageManager->getAvailablePngImages();
-		for (const auto& image : imageList)
-		{
-			j["FirmamentImages"] += image;
-		}
+        #ifdef LOGGING
+		mConnectionManager->LogMessage(j.dump(4));
+        #endif
+	}
 
-		mConnectionManager->SetGlobalSettings(j);
+	// send list of images
+	std::set <std::string> imageList = mStreamDeckImageManager->getAvailablePngImages();
+	for (const auto& image : imageList)
+	{
+		j["FirmamentImages"] += image;
 	}
 
-	// send reload command now that global settings are sent
-	for (const auto& context : mContextServerMap)
+	return j;
+}
+
+/**
+	@brief Sends new global settings and has the property inspectors read them, does nothing if
+	they are the same as the last ones published or received
+
+	@param[in] settings the global settings, without a version
+**/
+void FFXIVFirmamentTrackerPlugin::publishGlobalSettings(json settings)
+{
+	// warning: lock mVisibleContextsMutex before calling!
+
+	// compare without the version, it changes with every publish
+	// nothing published yet, or a dump that is not an object, counts as changed
+	json previous = mGlobalSettingsDump.empty() ? json() : json::parse(mGlobalSettingsDump);
+	if (previous.is_object())
 	{
+		previous.erase("SettingsVersion");
+		if (previous == settings)
+			return;
+	}
+
+	settings["SettingsVersion"] = ++mGlobalSettingsVersion;
+	mGlobalSettingsDump = settings.dump();
+	mConnectionManager->SetGlobalSettings(settings);
+	reloadPropertyInspectors();
+}
+
+/**
+	@brief Tells every open property inspector to read the settings again, the others read them when they open
+**/
+void FFXIVFirmamentTrackerPlugin::reloadPropertyInspectors()
+{
+	// warning: lock mVisibleContextsMutex before calling!
+
+	for (const auto& sent : mSentState)
+	{
+		if (!sent.second.isPropertyInspectorOpen)
+			continue;
+
 		json j;
 		j["reload"];
-		mConnectionManager->SendToPropertyInspector("", context.first, j);
+		mConnectionManager->SendToPropertyInspector("", sent.first, j);
+	}
+}
+
+/**
+	@brief Sets the title of a context if it is different from the last one sent
+**/
+void FFXIVFirmamentTrackerPlugin::sendTitleIfChanged(const std::string& title, const std::string& inContext)
+{
+	// warning: lock mVisibleContextsMutex before calling!
+
+	sentState_t& sent = mSentState[inContext];
+	if (sent.hasTitle && sent.title == title)
+		return;
+
+	sent.title = title;
+	sent.hasTitle = true;
+	mConnectionManager->SetTitle(title, inContext, kESDSDKTarget_HardwareAndSoftware);
+}
+
+/**
+	@brief Sets the image of a context if it is different from the last one sent
+**/
+void FFXIVFirmamentTrackerPlugin::sendImageIfChanged(const std::shared_ptr<const std::string>& image, const std::string& inContext)
+{
+	// warning: lock mVisibleContextsMutex before calling!
+
+	// cached images are shared, the same pointer is the same image
+	sentState_t& sent = mSentState[inContext];
+	if (sent.image != nullptr && (sent.image == image || *sent.image == *image))
+		return;
+
+	sent.image = image;
+	mConnectionManager->SetImage(image, inContext, 0);
+}
+
+/**
+	@brief Sends a payload to the property inspector of a context if it is open and the payload is
+	different from the last one sent
+**/
+void FFXIVFirmamentTrackerPlugin::sendToPropertyInspectorIfChanged(const json& payload, const std::string& inContext)
+{
+	// warning: lock mVisibleContextsMutex before calling!
+
+	sentState_t& sent = mSentState[inContext];
+	if (!sent.isPropertyInspectorOpen)
+		return;
+
+	std::string dump = payload.dump();
+	if (sent.propertyInspectorPayload == dump)
+		return;
+
+	sent.propertyInspectorPayload = dump;
+	mConnectionManager->SendToPropertyInspector("", inContext, payload);
+}
+
+/**
+	@brief Runs when the property inspector of a context is opened, sends it the current status
+**/
+void FFXIVFirmamentTrackerPlugin::PropertyInspectorDidAppear(const std::string& inAction, const std::string& inContext, const std::string& inDeviceID)
+{
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
+	mVisibleContextsMutex.lock();
+	if (mContextServerMap.find(inContext) != mContextServerMap.end())
+	{
+		sentState_t& sent = mSentState[inContext];
+		sent.isPropertyInspectorOpen = true;
+		sent.propertyInspectorPayload.clear();
+		this->UpdateUI(inContext);
 	}
+	mVisibleContextsMutex.unlock();
+}
 
-	// wake timer to update all UI elements
-	mTimer->wake();
+/**
+	@brief Runs when the property inspector of a context is closed
+**/
+void FFXIVFirmamentTrackerPlugin::PropertyInspectorDidDisappear(const std::string& inAction, const std::string& inContext, const std::string& inDeviceID)
+{
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
+	mVisibleContextsMutex.lock();
+	auto sentIt = mSentState.find(inContext);
+	if (sentIt != mSentState.end())
+	{
+		sentIt->second.isPropertyInspectorOpen = false;
+		sentIt->second.propertyInspectorPayload.clear();
+	}
 	mVisibleContextsMutex.unlock();
+}
+
+/**
+	@brief Runs when app recieves global settings
+**/
+void FFXIVFirmamentTrackerPlugin::DidReceiveGlobalSettings(const json& inPayload)
+{
+	LatencyHistogram::ScopedTimer latencyTimer(mHandlerLatency);
+
+	std::lock_guard<std::mutex> lock(mVisibleContextsMutex);
+	json j = inPayload["settings"];
+
+	// the settings we published coming back, or the same settings again
+	std::string dump = j.dump();
+	if (dump == mGlobalSettingsDump)
+		return;
+	mGlobalSettingsDump = dump;
+
+	// publish newer than any version seen, settings saved in an earlier run have versions too
+	if (j.find("SettingsVersion") != j.end() && j["SettingsVersion"].is_number_unsigned())
+		mGlobalSettingsVersion = (std::max)(mGlobalSettingsVersion, j["SettingsVersion"].get<unsigned int>());
+
+	// check for change in firmament website
+	bool isUrlChanged = false;
+	if (j.find("FirmamentUrl") != j.end() && j["FirmamentUrl"].is_string())
+	{
+		std::string url = j["FirmamentUrl"].get<std::string>();
+		if (url != mUrl)
+		{
+			mUrl = url;
+			mFirstRead = true;
+			mLastReadTime = 0;
+			mAdaptivePoller->reset();
+			isUrlChanged = true;
+		}
+	}
+
+	if (isUrlChanged)
+	{
+		// only a new url needs a read, the timer thread sends the server menu and reloads
+		// the property inspectors once it is done so the event loop is not blocked by the download
+		mTimer->wake(mPollJob);
+	}
+	else if (!mFirstRead)
+	{
+		// same url, the settings only lost what we publish (the inspector saves just the url),
+		// put it back from the last read and re-render from it without reading again
+		publishGlobalSettings(buildGlobalSettings(mUrl));
+		for (const auto& context : mContextServerMap)
+			this->UpdateUI(context.first);
+	}
 }
\ No newline at end of file
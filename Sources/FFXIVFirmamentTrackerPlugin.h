@@ -12,10 +12,15 @@
 #include "Common/ESDBasePlugin.h"
 #include <mutex>
 #include <unordered_map>
+#include <unordered_set>
+#include <ctime>
+
+#include "Windows/LatencyHistogram.h"
 
 class FirmamentTrackerHelper;
 class CallBackTimer;
 class StreamDeckImageManager;
+class AdaptivePoller;
 
 class FFXIVFirmamentTrackerPlugin : public ESDBasePlugin
 {
@@ -32,9 +37,13 @@ public:
 	
 	void DeviceDidConnect(const std::string& inDeviceID, const json &inDeviceInfo) override;
 	void DeviceDidDisconnect(const std::string& inDeviceID) override;
+	void SystemDidWakeUp() override;
 	
 	void SendToPlugin(const std::string& inAction, const std::string& inContext, const json &inPayload, const std::string& inDeviceID) override;
 	void DidReceiveGlobalSettings(const json& inPayload) override;
+
+	void PropertyInspectorDidAppear(const std::string& inAction, const std::string& inContext, const std::string& inDeviceID) override;
+	void PropertyInspectorDidDisappear(const std::string& inAction, const std::string& inContext, const std::string& inDeviceID) override;
 private:
 	
 	void UpdateUI(const std::string& inContext);
@@ -51,16 +60,51 @@ private:
 	std::unordered_map<std::string, contextMetaData_t> mContextServerMap;
 
 	contextMetaData_t readJsonIntoMetaData(const json& payload);
+
+	// what was last sent to each context, so unchanged values are not sent again
+	struct sentState_t
+	{
+		std::string title;
+		std::shared_ptr<const std::string> image; // nullptr until one is sent
+		std::string propertyInspectorPayload; // empty until one is sent
+		bool hasTitle = false;
+		bool isPropertyInspectorOpen = false; // inspector payloads are only sent while it is open
+	};
+	std::unordered_map<std::string, sentState_t> mSentState;
+
+	void sendTitleIfChanged(const std::string& title, const std::string& inContext);
+	void sendImageIfChanged(const std::shared_ptr<const std::string>& image, const std::string& inContext);
+	void sendToPropertyInspectorIfChanged(const json& payload, const std::string& inContext);
 	
 	std::unique_ptr<FirmamentTrackerHelper> mFirmamentTrackerHelper = std::make_unique <FirmamentTrackerHelper>();
 	std::unique_ptr<CallBackTimer> mTimer = std::make_unique <CallBackTimer>();
+	std::unique_ptr<AdaptivePoller> mAdaptivePoller = std::make_unique <AdaptivePoller>();
 
 	std::unique_ptr<StreamDeckImageManager> mStreamDeckImageManager = std::make_unique <StreamDeckImageManager>("Images/Icons/");
 
-	void startTimers();
+	unsigned int mPollJob = 0; // id of the read job in mTimer, 0 (CallBackTimer::INVALID_JOB) when not polling
+	void startTimers(bool isReadNow);
+	void stopTimers();
+	void updatePolling();
+
+	// polling only runs while something is shown on a connected device
+	std::unordered_set<std::string> mConnectedDevices;
+	bool mIsPolling = false;
+	time_t mLastReadTime = 0; // wall clock time of the last successful read of mUrl, 0 if none
+
+	json buildGlobalSettings(const std::string& url);
+	void publishGlobalSettings(json settings);
+	void reloadPropertyInspectors();
 
 	std::string mUrl = "https://na.finalfantasyxiv.com/lodestone/ishgardian_restoration/builders_progress_report/";
 	bool mFirstRead = true; // if we're on the first read of this url
 
+	// the global settings last published or received, settings that match them are ignored so
+	// the inspectors reloading and asking for the settings again doesn't cause another round
+	std::string mGlobalSettingsDump = "";
+	unsigned int mGlobalSettingsVersion = 0; // increases with every change, carried in the settings
+
+	LatencyHistogram mHandlerLatency; // time spent in the stream deck event handlers
+
 	bool isInit = false; // on init we need to call GetGlobalSettings
 };
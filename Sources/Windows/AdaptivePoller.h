@@ -0,0 +1,267 @@
+//==============================================================================
+/**
+@file       AdaptivePoller.h
+@brief      Learns when the progress report is published and schedules reads around it
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#pragma once
+
+#include <chrono>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <algorithm> // for sort, min
+
+/**
+	@brief The page is published once an hour. Each cycle the poller reads a little before the
+	expected publication offset, then probes at growing intervals after it until the content
+	changes. The time of the first read that saw new content is remembered and the median of
+	recent ones becomes the expected offset. Cycles with no change at all make the poller skip hours.
+**/
+class AdaptivePoller
+{
+public:
+	typedef std::chrono::steady_clock clock_t;
+
+	/**
+		@param[in] defaultOffset seconds into the hour the page is expected until a change is seen
+	**/
+	AdaptivePoller(int defaultOffset = 60)
+		:mDefaultOffset(defaultOffset)
+	{
+	}
+
+	/**
+		@brief Call after every successful read
+
+		@param[in] contentHash hash of the read content
+	**/
+	void recordRead(std::size_t contentHash)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		time_t now = time(0);
+
+		// a read at or after the cycle's pending probe time is that probe, other reads were started
+		// out of schedule, e.g. on start up or when the url changed
+		bool isProbe = mIsWaitingForChange &&
+			difftime(now, mCycleTime + PROBE_OFFSETS[mProbeIndex]) >= -PROBE_TOLERANCE;
+
+		bool isChanged = mHasHash && contentHash != mLastHash;
+
+		// a change at the early probe is either this cycle's publication coming sooner than expected
+		// or the previous cycle's one that came after its probes stopped. The probe after it tells
+		// them apart, the early probe's time is only learned if nothing changed since.
+		if (mHasEarlyChange && isProbe)
+		{
+			if (!isChanged)
+			{
+				addChangeOffsetLocked(mEarlyChangeTime);
+				mIsWaitingForChange = false;
+			}
+			mHasEarlyChange = false;
+		}
+
+		if (isChanged)
+		{
+			bool isEarlyProbe = isProbe && mProbeIndex == 0;
+			if (isEarlyProbe && mIsLastReadProbe && difftime(now, mLastReadTime) < MAX_PROBE_GAP)
+			{
+				// keep probing this cycle to confirm it
+				mHasEarlyChange = true;
+				mEarlyChangeTime = now;
+				mUnchangedCycles = 0;
+			}
+			else
+			{
+				// only a change seen shortly after the previous read says when the page was published
+				if (difftime(now, mLastReadTime) <= MAX_CHANGE_WINDOW)
+					addChangeOffsetLocked(now);
+
+				mHasEarlyChange = false;
+				if (mIsWaitingForChange)
+				{
+					mIsWaitingForChange = false;
+					mUnchangedCycles = 0;
+				}
+			}
+		}
+
+		mHasHash = true;
+		mLastHash = contentHash;
+		mLastReadTime = now;
+		mIsLastReadProbe = isProbe;
+	}
+
+	/**
+		@brief Find when to read next, call after the read's result was recorded
+
+		@return the deadline of the next read on the steady clock
+	**/
+	clock_t::time_point getNextDeadline()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		time_t now = time(0);
+
+		// still waiting for this cycle's change, probe again
+		while (mIsWaitingForChange)
+		{
+			mProbeIndex++;
+			if (mProbeIndex >= (int)(sizeof(PROBE_OFFSETS) / sizeof(PROBE_OFFSETS[0])))
+			{
+				// nothing was published this cycle, unless the early probe saw a change that couldn't be confirmed
+				if (!mHasEarlyChange)
+					mUnchangedCycles++;
+				mHasEarlyChange = false;
+				mIsWaitingForChange = false;
+				break;
+			}
+
+			time_t probeTime = mCycleTime + PROBE_OFFSETS[mProbeIndex];
+			if (difftime(probeTime, now) > 0)
+				return toDeadline(probeTime, now);
+		}
+
+		// start the next cycle at the expected offset, skip hours if the page hasn't changed in a while
+		int offset = getExpectedOffsetLocked();
+		time_t cycleTime = now - secondsIntoHour(now) + offset;
+		while (difftime(cycleTime + PROBE_OFFSETS[0], now) < 1)
+			cycleTime += 3600;
+
+		int skippedHours = 0;
+		if (mUnchangedCycles > BACKOFF_AFTER_CYCLES)
+			skippedHours = (std::min)(1 << (std::min)(mUnchangedCycles - BACKOFF_AFTER_CYCLES - 1, 8), MAX_SKIPPED_HOURS);
+		cycleTime += 3600 * skippedHours;
+
+		mCycleTime = cycleTime;
+		mProbeIndex = 0;
+		mHasEarlyChange = false;
+		mIsWaitingForChange = true;
+		return toDeadline(mCycleTime + PROBE_OFFSETS[0], now);
+	}
+
+	/**
+		@brief Forget everything learned, call when the url changes
+	**/
+	void reset()
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mHasHash = false;
+		mIsLastReadProbe = false;
+		mHasEarlyChange = false;
+		mChangeOffsets.clear();
+		mIsWaitingForChange = false;
+		mUnchangedCycles = 0;
+	}
+
+	/**
+		@brief Checks if the page is expected to have been published since a time
+
+		@param[in] readTime wall clock time of the last read, 0 if there was none
+
+		@return true if a read now could see new content
+	**/
+	bool isPublishedSince(time_t readTime) const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		time_t now = time(0);
+		if (readTime == 0 || difftime(now, readTime) >= 3600)
+			return true;
+
+		// the latest expected publication that is not in the future
+		time_t publication = now - secondsIntoHour(now) + getExpectedOffsetLocked();
+		if (difftime(publication, now) > 0)
+			publication -= 3600;
+		return difftime(publication, readTime) > 0;
+	}
+
+	/**
+		@brief Get the expected publication time
+
+		@return seconds into the hour
+	**/
+	int getExpectedOffset() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return getExpectedOffsetLocked();
+	}
+
+	/**
+		@brief Format the learned state for logging
+
+		@return one line summary
+	**/
+	std::string format() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return "expected offset " + std::to_string(getExpectedOffsetLocked()) + "s" +
+			", changes seen " + std::to_string(mChangeOffsets.size()) +
+			", unchanged cycles " + std::to_string(mUnchangedCycles);
+	}
+
+private:
+	// read times of a cycle, in seconds from the expected offset. The first read is a little early
+	// so the offset can move earlier when the page starts being published sooner.
+	static constexpr int PROBE_OFFSETS[] = { -60, 30, 120, 300, 600, 1200 };
+	static constexpr int MAX_CHANGE_WINDOW = 1500; // seconds between reads for a change to count
+	static constexpr int MAX_PROBE_GAP = 4500; // seconds from the previous cycle's last probe for an early change to count, more means hours were skipped
+	static constexpr int PROBE_TOLERANCE = 5; // seconds a probe may run before its time
+	static constexpr std::size_t MAX_CHANGE_OFFSETS = 8;
+	static constexpr int BACKOFF_AFTER_CYCLES = 2; // unchanged cycles before skipping hours
+	static constexpr int MAX_SKIPPED_HOURS = 4;
+
+	const int mDefaultOffset;
+
+	mutable std::mutex mMutex;
+	bool mHasHash = false;
+	std::size_t mLastHash = 0;
+	time_t mLastReadTime = 0;
+	bool mIsLastReadProbe = false;
+	std::deque<int> mChangeOffsets; // seconds into the hour of recent first reads with new content
+
+	bool mIsWaitingForChange = false;
+	bool mHasEarlyChange = false; // the early probe saw a change, waiting for the next probe to confirm it
+	time_t mEarlyChangeTime = 0;
+	time_t mCycleTime = 0; // expected publication time of the current cycle
+	int mProbeIndex = 0;
+	int mUnchangedCycles = 0;
+
+	void addChangeOffsetLocked(time_t changeTime)
+	{
+		mChangeOffsets.push_back(secondsIntoHour(changeTime));
+		if (mChangeOffsets.size() > MAX_CHANGE_OFFSETS)
+			mChangeOffsets.pop_front();
+	}
+
+	int getExpectedOffsetLocked() const
+	{
+		if (mChangeOffsets.empty())
+			return mDefaultOffset;
+
+		// median of the offsets, measured from the newest one so offsets around the hour don't wrap
+		int reference = mChangeOffsets.back();
+		std::vector<int> deltas;
+		deltas.reserve(mChangeOffsets.size());
+		for (const auto& offset : mChangeOffsets)
+			deltas.push_back((offset - reference + 3600 + 1800) % 3600 - 1800);
+		std::sort(deltas.begin(), deltas.end());
+
+		return (reference + deltas[deltas.size() / 2] + 3600) % 3600;
+	}
+
+	static int secondsIntoHour(time_t time)
+	{
+		struct tm localTime {};
+		localtime_s(&localTime, &time);
+		return localTime.tm_min * 60 + localTime.tm_sec;
+	}
+
+	static clock_t::time_point toDeadline(time_t time, time_t now)
+	{
+		// the wall clock is only used to find the wait, the steady clock does the waiting
+		return clock_t::now() + std::chrono::seconds((long long)difftime(time, now));
+	}
+};
@@ -10,19 +10,36 @@
 
 #include <atomic>
 #include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <thread>
+#include <unordered_map>
+#include <set>
 #include <vector>
 #include <functional> // for function
 #include <algorithm> // for min
 
+#include "TimerWheel.h"
+#include "RetryPolicy.h"
+
 /**
-	@brief Timer that triggers on a specified interval
+	@brief Scheduler that runs jobs on one thread at steady clock deadlines kept in a timer wheel.
+	Jobs can be woken early, cancelled, and are all stopped and joined by stop().
 **/
 class CallBackTimer
 {
 public:
+	typedef TimerWheel::id_t jobId_t;
+	typedef std::chrono::steady_clock clock_t;
+
+	// a job returns the deadline of its next run
+	typedef std::function<clock_t::time_point(void)> job_t;
+
+	static const jobId_t INVALID_JOB = 0;
+
 	CallBackTimer()
+		:mWheel(TICK)
 	{
-		lock();
 	}
 
 	~CallBackTimer()
@@ -31,17 +48,70 @@ public:
 	}
 
 	/**
-		@brief Unlocks mutex and stops/joins the thread
+		@brief Cancels all jobs and joins the thread. A job that is running finishes first,
+		no job runs after this returns.
 	**/
 	void stop()
 	{
-		running = false;
-		if (locked)
 		{
-			unlock();
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (const auto& job : mJobs)
+				mWheel.cancel(job.first);
+			mJobs.clear();
+
+			// from inside a job the thread can't join itself, it stays idle until the next job
+			if (mThread.get_id() == std::this_thread::get_id())
+				return;
+			mIsStopping = true;
 		}
-		if (thd.joinable())
-			thd.join();
+		mCondition.notify_all();
+
+		if (mThread.joinable())
+			mThread.join();
+	}
+
+	/**
+		@brief Adds a job to the scheduler, starting the thread if needed
+
+		@param[in] func the job, returns the deadline of its next run
+		@param[in] firstDeadline when the job first runs
+		@param[in] tolerance how late the job may run, lets jobs due around the same time run together
+
+		@return id of the job, used to wake or cancel it
+	**/
+	jobId_t addJob(job_t func, clock_t::time_point firstDeadline = clock_t::now(), clock_t::duration tolerance = clock_t::duration::zero())
+	{
+		jobId_t id = INVALID_JOB;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (!mThread.joinable())
+			{
+				mIsStopping = false;
+				mThread = std::thread([this]() { run(); });
+			}
+
+			id = ++mLastJobId;
+			if (id == INVALID_JOB)
+				id = ++mLastJobId;
+			mJobs[id] = { func, tolerance, false };
+			mWheel.insert(id, firstDeadline, tolerance);
+		}
+		mCondition.notify_all();
+		return id;
+	}
+
+	/**
+		@brief Removes a job. Does not wait if the job is running, it just won't run again.
+
+		@param[in] id the job to remove
+
+		@return true if the job was found
+	**/
+	bool cancel(jobId_t id)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mWheel.cancel(id);
+		return mJobs.erase(id) > 0;
 	}
 
 	/**
@@ -49,33 +119,21 @@ public:
 
 		@param[in] interval the milliseconds to wait
 		@param[in] func the function to trigger
+
+		@return id of the job, INVALID_JOB if already running
 	**/
-	void start(unsigned int interval, std::function<void(void)> func)
+	jobId_t start(unsigned int interval, std::function<void(void)> func)
 	{
 		// can't be already running
-		if (running == true)
+		if (is_running())
 		{
-			return;
+			return INVALID_JOB;
 		}
 
-		running = true;
-
-		// start the timer thread
-		thd = std::thread([this, interval, func]()
+		return addJob([interval, func]()
 			{
-				while (running)
-				{
-					func();
-					// wait
-					if (timerMutex.try_lock_for(std::chrono::milliseconds(interval)))
-					{
-						unlock();
-					}
-					if (!locked)
-					{
-						lock();
-					}
-				}
+				func();
+				return clock_t::now() + std::chrono::milliseconds(interval);
 			});
 	};
 
@@ -83,79 +141,46 @@ public:
 		@brief starts the callback loop with given minute-of-the-hour trigger times and ability to wake
 
 		@param[in] triggerMinuteOfTheHour set of the minutes of the hour to trigger on (0-59)
-		@param[in] func the function to trigger, should return true on success
+		@param[in] func the function to trigger, should return true on success, failures are retried by getRetryPolicy()
+		@param[in] isRunNow call func right away, otherwise wait for the first trigger time
+
+		@return id of the job, INVALID_JOB if already running
+	**/
+	jobId_t start(std::set<int> triggerMinutesOfTheHour, std::function<bool(void)> func, bool isRunNow = true)
+	{
+		return start([triggerMinutesOfTheHour]() { return nextMinuteOfTheHour(triggerMinutesOfTheHour); }, func, isRunNow);
+	}
+
+	/**
+		@brief starts the callback loop with trigger times chosen after each successful call and ability to wake
+
+		@param[in] nextTrigger returns the next trigger time, called after each successful call
+		@param[in] func the function to trigger, should return true on success, failures are retried by getRetryPolicy()
+		@param[in] isRunNow call func right away, otherwise wait for the first trigger time
+
+		@return id of the job, INVALID_JOB if already running
 	**/
-	void start(std::set<int> triggerMinutesOfTheHour, std::function<bool(void)> func)
+	jobId_t start(std::function<clock_t::time_point(void)> nextTrigger, std::function<bool(void)> func, bool isRunNow = true)
 	{
 		// can't be already running
-		if (running == true)
+		if (is_running())
 		{
-			return;
+			return INVALID_JOB;
 		}
 
-		running = true;
-
-		// start the timer thread
-		thd = std::thread([this, triggerMinutesOfTheHour, func]()
+		return addJob([this, nextTrigger, func]()
 			{
-				while (running)
-				{
-					// get current time
-					time_t now = time(0);
-					// find the closest trigger time
-					time_t nextTriggerTime = 0;
-					bool isFirst = true;
-					for (const auto& triggerMinute : triggerMinutesOfTheHour)
-					{
-						if (triggerMinute < 0 || triggerMinute >= 60)
-							continue;
-
-						struct tm newTime {};
-						localtime_s(&newTime, &now);
-						newTime.tm_sec = 0;
-						newTime.tm_min = triggerMinute;
-						time_t triggerTime = mktime(&newTime);
-
-						// if the new time is behind us, it means the next trigger minute is in an hour
-						if (difftime(triggerTime, now) < 1)
-						{
-							triggerTime += 3600; // increment by an hour
-						}
-
-						// store the closest trigger time
-						if (isFirst || (triggerTime < nextTriggerTime))
-						{
-							nextTriggerTime = triggerTime;
-							isFirst = false;
-						}
-					}
-
-					// call the desired function
-					int status = func();
-
-					int waitTime = 0;
-					if (status == false) // function failed, retry in 5s
-					{
-						waitTime = 5;
-					}
-					else
-					{
-						// function may be slow, recompute current time, diff maybe be negative which in that case we immeadiatly unlock mutex
-						now = time(0);
-						waitTime = (int)(difftime(nextTriggerTime, now));
-					}
-
-					// wait
-					if (timerMutex.try_lock_for(std::chrono::seconds(waitTime)))
-					{
-						unlock();
-					}
-					if (!locked)
-					{
-						lock();
-					}
-				}
-			});
+				// call the desired function
+				mRetryPolicy.beginAttempt();
+				bool status = func();
+
+				if (status == false) // function failed, back off before retrying
+					return clock_t::now() + mRetryPolicy.onFailure();
+				mRetryPolicy.onSuccess();
+
+				// function may be slow, compute the next trigger time once it is done
+				return nextTrigger();
+			}, isRunNow ? clock_t::now() : nextTrigger());
 	}
 
 	/**
@@ -163,37 +188,183 @@ public:
 
 		@return true if thread is running
 	**/
-	bool is_running() const noexcept
+	bool is_running() const
 	{
-		return (running && thd.joinable());
+		std::lock_guard<std::mutex> lock(mMutex);
+		return (!mIsStopping && mThread.joinable() && !mJobs.empty());
 	}
 
 	/**
-		@brief force a wakeup even if trigger time not met
+		@brief force a wakeup of every job even if trigger time not met
 	**/
 	void wake()
 	{
-		if (is_running() && locked)
 		{
-			unlock();
+			std::lock_guard<std::mutex> lock(mMutex);
+			for (auto& job : mJobs)
+				wakeJob(job.first, job.second);
 		}
+		mCondition.notify_all();
+	}
+
+	/**
+		@brief force a wakeup of one job even if trigger time not met
+
+		@param[in] id the job to wake
+	**/
+	void wake(jobId_t id)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			auto it = mJobs.find(id);
+			if (it == mJobs.end())
+				return;
+			wakeJob(it->first, it->second);
+		}
+		mCondition.notify_all();
+	}
+
+	/**
+		@brief Finds the closest upcoming minute-of-the-hour trigger time
+
+		@param[in] triggerMinutesOfTheHour set of the minutes of the hour (0-59)
+
+		@return the trigger time on the steady clock
+	**/
+	static clock_t::time_point nextMinuteOfTheHour(const std::set<int>& triggerMinutesOfTheHour)
+	{
+		// read the wall clock once, the trigger minutes are offsets into the current hour
+		time_t now = time(0);
+		struct tm nowTime {};
+		localtime_s(&nowTime, &now);
+		int secondsIntoHour = nowTime.tm_min * 60 + nowTime.tm_sec;
+
+		// find the closest trigger time
+		int waitTime = -1;
+		for (const auto& triggerMinute : triggerMinutesOfTheHour)
+		{
+			if (triggerMinute < 0 || triggerMinute >= 60)
+				continue;
+
+			// if the trigger minute is behind us, the next one is in an hour
+			int wait = triggerMinute * 60 - secondsIntoHour;
+			if (wait < 1)
+				wait += 3600;
+
+			if (waitTime < 0 || wait < waitTime)
+				waitTime = wait;
+		}
+
+		// no valid minutes, check back in an hour
+		if (waitTime < 0)
+			waitTime = 3600;
+
+		// the wall clock is only used to find the wait, the steady clock does the waiting
+		return clock_t::now() + std::chrono::seconds(waitTime);
+	}
+
+	/**
+		@brief Get the retry policy used when a minute-of-the-hour job fails
+
+		@return the retry policy
+	**/
+	RetryPolicy& getRetryPolicy()
+	{
+		return mRetryPolicy;
+	}
+
+	/**
+		@brief Lists the next deadlines of the scheduled jobs
+
+		@param[in] count the maximum number of deadlines to return
+
+		@return job id and deadline pairs, earliest first. Running jobs are not included.
+	**/
+	std::vector<std::pair<jobId_t, clock_t::time_point>> getNextDeadlines(std::size_t count) const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mWheel.getNextDeadlines(count);
 	}
 private:
-	std::atomic_bool running = false;
-	std::thread thd;
+	// resolution of the deadlines, jobs run up to one tick late
+	static constexpr std::chrono::milliseconds TICK = std::chrono::milliseconds(100);
+
+	struct scheduledJob_t
+	{
+		job_t func;
+		clock_t::duration tolerance;
+		bool isWoken; // woken while running, run again right after
+	};
+
+	mutable std::mutex mMutex;
+	std::condition_variable mCondition;
+	std::thread mThread;
+	bool mIsStopping = false;
 
-	std::timed_mutex timerMutex;
-	std::atomic_bool locked = false;
+	std::unordered_map<jobId_t, scheduledJob_t> mJobs;
+	TimerWheel mWheel;
+	RetryPolicy mRetryPolicy;
+	jobId_t mLastJobId = INVALID_JOB;
+	jobId_t mRunningJob = INVALID_JOB;
 
-	void lock()
+	void wakeJob(jobId_t id, scheduledJob_t& job)
 	{
-		timerMutex.lock();
-		locked = true;
+		job.isWoken = true;
+
+		// a running job is not in the wheel, it is put back once it returns
+		if (id != mRunningJob)
+			mWheel.insert(id, clock_t::now());
 	}
 
-	void unlock()
+	/**
+		@brief Runs due jobs until stop() is called
+	**/
+	void run()
 	{
-		locked = false;
-		timerMutex.unlock();
+		std::vector<jobId_t> due;
+		std::unique_lock<std::mutex> lock(mMutex);
+		while (!mIsStopping)
+		{
+			due.clear();
+			mWheel.advance(clock_t::now(), due);
+
+			// nothing due, wait for the next deadline, a wake, new job, or cancel
+			if (due.empty())
+			{
+				clock_t::time_point deadline;
+				if (mWheel.getNextDeadline(deadline))
+					mCondition.wait_until(lock, deadline);
+				else
+					mCondition.wait(lock);
+				continue;
+			}
+
+			for (const auto& id : due)
+			{
+				auto job = mJobs.find(id);
+				if (mIsStopping || job == mJobs.end())
+					continue;
+
+				job_t func = job->second.func;
+				job->second.isWoken = false;
+				mRunningJob = id;
+
+				// run the job without the lock so it can wake or cancel
+				lock.unlock();
+				clock_t::time_point deadline = func();
+				lock.lock();
+
+				mRunningJob = INVALID_JOB;
+				job = mJobs.find(id);
+				if (job != mJobs.end())
+				{
+					if (job->second.isWoken)
+						mWheel.insert(id, clock_t::now());
+					else
+						mWheel.insert(id, deadline, job->second.tolerance);
+					job->second.isWoken = false;
+				}
+			}
+		}
 	}
-};
\ No newline at end of file
+};
@@ -0,0 +1,158 @@
+//==============================================================================
+/**
+@file       CurlFetchClient.cpp
+@brief      Long lived curl client that reuses its connection between downloads
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#include "pch.h"
+#include "CurlFetchClient.h"
+
+#include <algorithm> // for max
+
+CurlFetchClient::CurlFetchClient()
+{
+}
+
+CurlFetchClient::~CurlFetchClient()
+{
+	if (mCurl != nullptr)
+		curl_easy_cleanup(mCurl);
+}
+
+/**
+	@brief download url's html data, handing each received piece to onChunk.
+	The connection is kept open for the next call.
+
+	@param[in] url the url to download from
+	@param[in] requestValidators validators of the copy we already have, empty to always download
+	@param[out] responseValidators validators of the downloaded page
+	@param[in] onChunk called with each piece of html data downloaded
+	@param[out] httpCode http response code, 200 if downloaded or 304 if not modified
+
+	@return true if success
+**/
+bool CurlFetchClient::fetch(const std::string& url, const curlutils::validators_t& requestValidators,
+	curlutils::validators_t& responseValidators, curlutils::chunkCallback_t onChunk, long& httpCode)
+{
+	if (mCurl == nullptr)
+	{
+		mCurl = curl_easy_init();
+		if (mCurl == nullptr)
+		{
+			httpCode = 0;
+			mLastStats = {};
+			return false;
+		}
+		curlutils::setCommonOptions(mCurl);
+
+		// the default of 60s would expire between the hourly polls
+		curl_easy_setopt(mCurl, CURLOPT_DNS_CACHE_TIMEOUT, 2 * 60 * 60);
+		curl_easy_setopt(mCurl, CURLOPT_TCP_KEEPALIVE, 1L);
+	}
+
+	// count the decompressed bytes on their way to the parser
+	std::size_t decodedBytes = 0;
+	curlutils::chunkCallback_t countingOnChunk = [&decodedBytes, &onChunk](const char* data, std::size_t size)
+	{
+		decodedBytes += size;
+		onChunk(data, size);
+	};
+
+	CURLcode result = curlutils::performRequest(mCurl, url, requestValidators, responseValidators, countingOnChunk, httpCode);
+	readStats(httpCode, decodedBytes);
+
+	// the server may have moved, start over with empty caches next time
+	if (result == CURLE_COULDNT_RESOLVE_HOST || result == CURLE_COULDNT_CONNECT ||
+		result == CURLE_OPERATION_TIMEDOUT || result == CURLE_SSL_CONNECT_ERROR)
+	{
+		resetHandle();
+	}
+
+	if (result == CURLE_OK && (httpCode == 200 || httpCode == 304))
+	{
+		return true;
+	}
+	return false;
+}
+
+/**
+	@brief Get the timings of the last download
+
+	@return stats of the last download
+**/
+CurlFetchClient::fetchStats_t CurlFetchClient::getLastStats() const
+{
+	return mLastStats;
+}
+
+/**
+	@brief Format download timings for logging
+
+	@param[in] stats the stats to format
+
+	@return one line description of the stats
+**/
+std::string CurlFetchClient::formatStats(const fetchStats_t& stats)
+{
+	char buffer[320];
+	int length = snprintf(buffer, sizeof(buffer),
+		"http %ld, dns %.1fms, connect %.1fms, tls %.1fms, first byte %.1fms, total %.1fms, new connections %ld, "
+		"body %.0f bytes",
+		stats.httpCode, stats.dnsMs, stats.connectMs, stats.tlsMs, stats.firstByteMs, stats.totalMs, stats.newConnections,
+		stats.decodedBytes);
+
+	// the wire size only differs when the server compressed the body
+	if (stats.wireBytes != stats.decodedBytes && length > 0 && length < (int)sizeof(buffer))
+		snprintf(buffer + length, sizeof(buffer) - length, " (%.0f bytes compressed)", stats.wireBytes);
+	return buffer;
+}
+
+/**
+	@brief Throw away the handle along with its connection, DNS and TLS caches
+**/
+void CurlFetchClient::resetHandle()
+{
+	curl_easy_cleanup(mCurl);
+	mCurl = nullptr;
+}
+
+/**
+	@brief Store the phase timings of the last download. curl reports each
+	phase as the time since the start of the request, convert them to durations.
+
+	@param[in] httpCode http response code of the download
+	@param[in] decodedBytes number of body bytes handed to the caller after decompression
+**/
+void CurlFetchClient::readStats(long httpCode, std::size_t decodedBytes)
+{
+	double nameLookup = 0.0;
+	double connect = 0.0;
+	double appConnect = 0.0;
+	double startTransfer = 0.0;
+	double total = 0.0;
+	long newConnections = 0;
+	double wireBytes = 0.0;
+	curl_easy_getinfo(mCurl, CURLINFO_NAMELOOKUP_TIME, &nameLookup);
+	curl_easy_getinfo(mCurl, CURLINFO_CONNECT_TIME, &connect);
+	curl_easy_getinfo(mCurl, CURLINFO_APPCONNECT_TIME, &appConnect);
+	curl_easy_getinfo(mCurl, CURLINFO_STARTTRANSFER_TIME, &startTransfer);
+	curl_easy_getinfo(mCurl, CURLINFO_TOTAL_TIME, &total);
+	curl_easy_getinfo(mCurl, CURLINFO_NUM_CONNECTS, &newConnections);
+	curl_easy_getinfo(mCurl, CURLINFO_SIZE_DOWNLOAD, &wireBytes);
+
+	// phases that did not happen are reported as 0
+	connect = (std::max)(connect, nameLookup);
+	appConnect = (std::max)(appConnect, connect);
+
+	mLastStats.httpCode = httpCode;
+	mLastStats.dnsMs = nameLookup * 1000.0;
+	mLastStats.connectMs = (connect - nameLookup) * 1000.0;
+	mLastStats.tlsMs = (appConnect - connect) * 1000.0;
+	mLastStats.firstByteMs = (std::max)(startTransfer - appConnect, 0.0) * 1000.0;
+	mLastStats.totalMs = total * 1000.0;
+	mLastStats.newConnections = newConnections;
+	mLastStats.wireBytes = wireBytes;
+	mLastStats.decodedBytes = (double)decodedBytes;
+}
@@ -0,0 +1,50 @@
+//==============================================================================
+/**
+@file       CurlFetchClient.h
+@brief      Long lived curl client that reuses its connection between downloads
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#pragma once
+
+#include "CurlUtils.hpp"
+
+/**
+	@brief Keeps one curl easy handle alive between downloads, so its connection cache,
+	DNS cache and TLS session cache are reused by the next poll. Not thread safe,
+	only one download may run at a time.
+**/
+class CurlFetchClient
+{
+public:
+	// how long each phase of a download took, in milliseconds
+	struct fetchStats_t
+	{
+		long httpCode = 0;
+		double dnsMs = 0.0; // name lookup
+		double connectMs = 0.0; // tcp connect
+		double tlsMs = 0.0; // tls handshake
+		double firstByteMs = 0.0; // request sent until the first response byte
+		double totalMs = 0.0; // the whole download
+		long newConnections = 0; // 0 if an existing connection was reused
+		double wireBytes = 0.0; // body bytes received, compressed if the server compressed them
+		double decodedBytes = 0.0; // body bytes after decompression
+	};
+
+	CurlFetchClient();
+	~CurlFetchClient();
+
+	bool fetch(const std::string& url, const curlutils::validators_t& requestValidators,
+		curlutils::validators_t& responseValidators, curlutils::chunkCallback_t onChunk, long& httpCode);
+	fetchStats_t getLastStats() const;
+
+	static std::string formatStats(const fetchStats_t& stats);
+
+private:
+	CURL* mCurl = nullptr;
+	fetchStats_t mLastStats;
+
+	void resetHandle();
+	void readStats(long httpCode, std::size_t decodedBytes);
+};
@@ -11,57 +11,181 @@
 #include <curl\curl.h>
 
 #include <string>
+#include <functional>
+#include <algorithm> // for equal
 
 namespace curlutils
 {
+	// receives each piece of the page body as it is downloaded
+	typedef std::function<void(const char*, std::size_t)> chunkCallback_t;
+
+	// cache validators of a response, sent back on the next request so the server can reply 304 Not Modified
+	struct validators_t
+	{
+		std::string etag = "";
+		std::string lastModified = "";
+	};
+
+	// state handed to the curl write callback
+	struct streamContext_t
+	{
+		CURL* curl = nullptr;
+		chunkCallback_t onChunk;
+	};
+
 	/**
-		@brief Callback function used for curl read
+		@brief case-insensitive check if a header line starts with a header name
+
+		@param[in] line the header line
+		@param[in] name the header name, without the ':'
+
+		@return true if the line is that header
 	**/
-	static std::size_t callback(
+	static bool isHeader(const std::string& line, const std::string& name)
+	{
+		if (line.length() <= name.length() || line[name.length()] != ':') return false;
+		return std::equal(name.begin(), name.end(), line.begin(),
+			[](char a, char b) {
+				return tolower(a) == tolower(b);
+			});
+	}
+
+	/**
+		@brief Get the value of a header line with surrounding whitespace removed
+
+		@param[in] line the header line
+
+		@return the value after the ':'
+	**/
+	static std::string headerValue(const std::string& line)
+	{
+		std::size_t startPos = line.find(':') + 1;
+		std::size_t endPos = line.find_last_not_of(" \t\r\n");
+		startPos = line.find_first_not_of(" \t", startPos);
+		if (startPos == std::string::npos || endPos == std::string::npos || endPos < startPos) return "";
+		return line.substr(startPos, endPos - startPos + 1);
+	}
+
+	/**
+		@brief Callback function used for curl headers, stores the cache validators
+	**/
+	static std::size_t headerCallback(
 		const char* in,
 		std::size_t size,
 		std::size_t num,
-		std::string* out)
+		validators_t* out)
 	{
 		const std::size_t totalBytes(size * num);
-		out->append(in, totalBytes);
+		const std::string line(in, totalBytes);
+
+		// a new status line means a new response, forget the headers of the previous one
+		if (line.compare(0, 5, "HTTP/") == 0)
+			*out = {};
+		else if (isHeader(line, "ETag"))
+			out->etag = headerValue(line);
+		else if (isHeader(line, "Last-Modified"))
+			out->lastModified = headerValue(line);
+
 		return totalBytes;
 	}
 
 	/**
-		@brief download url's html data into string
+		@brief Callback function used for curl read, forwards the body as it arrives
+	**/
+	static std::size_t callback(
+		const char* in,
+		std::size_t size,
+		std::size_t num,
+		streamContext_t* out)
+	{
+		const std::size_t totalBytes(size * num);
 
-		@param[in] html the url to download from
-		@param[out] data html data downloaded
+		// the headers are in by the time the body arrives, don't forward error pages
+		long httpCode = 0;
+		curl_easy_getinfo(out->curl, CURLINFO_RESPONSE_CODE, &httpCode);
+		if (httpCode == 200)
+			out->onChunk(in, totalBytes);
+
+		return totalBytes;
+	}
 
-		@return true if success
+	/**
+		@brief Check if curl was built with a decoder for compressed responses
+
+		@return true if built with zlib or brotli
 	**/
-	static bool readHTML(const std::string& html, std::string* data, long& httpCode)
+	static bool isCompressionSupported()
 	{
-		CURL* curl;
+		const curl_version_info_data* info = curl_version_info(CURLVERSION_NOW);
+		return info != nullptr && (info->features & (CURL_VERSION_LIBZ | CURL_VERSION_BROTLI)) != 0;
+	}
 
-		curl = curl_easy_init();
-		curl_easy_setopt(curl, CURLOPT_URL, html);
+	/**
+		@brief set the options that are the same for every request made with this handle
+
+		@param[in] curl the curl handle
+	**/
+	static void setCommonOptions(CURL* curl)
+	{
 		// Hide progress bar
 		curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 1);
 		// Don't wait forever, time out after 10 seconds.
 		curl_easy_setopt(curl, CURLOPT_TIMEOUT, 10);
+		// Ask for every compression curl was built with (gzip, deflate, br), curl
+		// decompresses as the data arrives so the write callback still gets plain html.
+		// The vendored libcurl_a.lib is built without zlib and brotli, so nothing is
+		// compressed until it is replaced by a build with them.
+		if (isCompressionSupported())
+			curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
 
-		data->clear();
-
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, headerCallback);
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, callback);
-		curl_easy_setopt(curl, CURLOPT_WRITEDATA, data);
+	}
+
+	/**
+		@brief download url's html data with an already set up handle, handing each received piece to onChunk.
+		If cache validators are given and the page did not change, the server replies
+		304 and no data is downloaded.
+
+		@param[in] curl the curl handle
+		@param[in] html the url to download from
+		@param[in] requestValidators validators of the copy we already have, empty to always download
+		@param[out] responseValidators validators of the downloaded page
+		@param[in] onChunk called with each piece of html data downloaded
+		@param[out] httpCode http response code, 200 if downloaded or 304 if not modified
+
+		@return curl result code
+	**/
+	static CURLcode performRequest(CURL* curl, const std::string& html, const validators_t& requestValidators,
+		validators_t& responseValidators, chunkCallback_t onChunk, long& httpCode)
+	{
+		curl_easy_setopt(curl, CURLOPT_URL, html.c_str());
+
+		// ask the server to skip the download if our copy is still current
+		struct curl_slist* headers = nullptr;
+		if (requestValidators.etag.length() > 0)
+			headers = curl_slist_append(headers, ("If-None-Match: " + requestValidators.etag).c_str());
+		if (requestValidators.lastModified.length() > 0)
+			headers = curl_slist_append(headers, ("If-Modified-Since: " + requestValidators.lastModified).c_str());
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+		responseValidators = {};
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, &responseValidators);
+
+		streamContext_t context = { curl, onChunk };
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, &context);
 
 		// grab raw html
-		curl_easy_perform(curl);
+		CURLcode result = curl_easy_perform(curl);
+		httpCode = 0;
 		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &httpCode);
 
-		curl_easy_cleanup(curl);
+		// don't leave pointers to this stack frame in the handle
+		curl_easy_setopt(curl, CURLOPT_HTTPHEADER, nullptr);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, nullptr);
+		curl_easy_setopt(curl, CURLOPT_WRITEDATA, nullptr);
+		curl_slist_free_all(headers);
 
-		if (httpCode == 200)
-		{
-			return true;
-		}
-		return false;
+		return result;
 	}
 }
\ No newline at end of file
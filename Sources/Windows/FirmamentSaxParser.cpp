@@ -0,0 +1,498 @@
+//==============================================================================
+/**
+@file       FirmamentSaxParser.cpp
+
+@brief		Single pass extractor for the firmament progress report page
+
+@copyright  (c) 2020, Momoko Tomoko
+
+**/
+//==============================================================================
+
+#include "pch.h"
+#include "FirmamentSaxParser.h"
+#include <algorithm>
+
+FirmamentSaxParser::FirmamentSaxParser(std::vector<FirmamentTrackerHelper::restorationRegion_t>& serverHierarchy,
+	std::unordered_map<std::string, FirmamentTrackerHelper::restorationServerStatus_t>& serverStatus)
+	:mServerHierarchy(serverHierarchy),
+	mServerStatus(serverStatus)
+{
+	mServerHierarchy.clear();
+	mServerStatus.clear();
+}
+
+/**
+	@brief Tokenize the next piece of the page. Only complete tags are handed to htmlcxx,
+	the incomplete tail is kept until the next piece arrives.
+
+	@param[in] data the html piece
+	@param[in] size length of the piece
+**/
+void FirmamentSaxParser::feed(const char* data, std::size_t size)
+{
+	if (mIsFinished) return;
+
+	mPending.append(data, size);
+
+	std::size_t split = findSafeSplit(mPending);
+	if (split == 0) return;
+
+	if (!mIsFailed && mPhase != phase_t::DONE)
+	{
+		std::string::const_iterator begin = mPending.cbegin();
+		std::string::const_iterator end = mPending.cbegin() + split;
+		parse(begin, end);
+	}
+	mPending.erase(0, split);
+}
+
+/**
+	@brief Tokenize whatever is left of the page and close any tags left open
+**/
+void FirmamentSaxParser::finish()
+{
+	if (mIsFinished) return;
+	mIsFinished = true;
+
+	if (!mPending.empty() && !mIsFailed && mPhase != phase_t::DONE)
+		parse(mPending);
+	mPending.clear();
+
+	if (mIsFailed || mPhase == phase_t::DONE) return;
+
+	if (mCapture != capture_t::NONE) store("");
+
+	while (!mOpenTags.empty() && !mIsFailed)
+	{
+		element_t element = mOpenTags.back().element;
+		mOpenTags.pop_back();
+		closeElement(element);
+	}
+}
+
+/**
+	@brief Check if the page was parsed without errors
+
+	@return true if success
+**/
+bool FirmamentSaxParser::isSuccess() const
+{
+	if (mIsFailed || !mIsFinished) return false;
+
+	// "report-region_select" was never found
+	if (mPhase == phase_t::SEEK_REGION_SELECT || mPhase == phase_t::IN_REGION_SELECT) return false;
+
+	return mHasRegionSibling;
+}
+
+/**
+	@brief Called by htmlcxx for every opening and closing tag
+
+	@param[in] node the tag
+	@param[in] isEnd true if this is a closing tag
+**/
+void FirmamentSaxParser::foundTag(htmlcxx::HTML::Node node, bool isEnd)
+{
+	if (mIsFailed || mPhase == phase_t::DONE) return;
+
+	if (isEnd)
+	{
+		closeTag(node);
+		return;
+	}
+
+	// this tag is the first child of the tag we wanted the text of
+	if (mCapture != capture_t::NONE) store(node.text());
+	if (mIsFailed) return;
+	if (mIsInBar) mWorld.barValue += node.text();
+
+	element_t element = element_t::NONE;
+	switch (mPhase)
+	{
+	case phase_t::SEEK_REGION_SELECT:
+		node.parseAttributes();
+		if (node.attribute("class").second == "report-region_select")
+		{
+			element = element_t::REGION_SELECT;
+			mRegionSelectDepth = mOpenTags.size();
+			mPhase = phase_t::IN_REGION_SELECT;
+		}
+		break;
+	case phase_t::IN_REGION_SELECT:
+		// the region names are the text of the links
+		if (htmlcxxutils::strCaseCmp(node.tagName(), "A"))
+			mCapture = capture_t::REGION_NAME;
+		break;
+	case phase_t::IN_REGIONS:
+		if (mOpenTags.size() == mRegionSelectDepth)
+		{
+			// sibling of "report-region_select", each div wraps the next region
+			mHasRegionSibling = true;
+			if (htmlcxxutils::strCaseCmp(node.tagName(), "div"))
+			{
+				// error if we have more divs here than region names
+				if (mRegionCount >= mServerHierarchy.size())
+				{
+					mIsFailed = true;
+					return;
+				}
+				element = element_t::REGION;
+				mRegionCount++;
+				mIsInRegion = true;
+			}
+		}
+		else if (mIsInRegion)
+		{
+			node.parseAttributes();
+			const std::string className = node.attribute("class").second;
+			if (className == "report-dc_name")
+			{
+				// error if the previous dc had no world list
+				if (mIsDcAwaitingList)
+				{
+					mIsFailed = true;
+					return;
+				}
+				mCapture = capture_t::DC_NAME;
+			}
+			else if (className == "report-world_list" && mIsDcAwaitingList && !mIsInWorldList)
+			{
+				element = element_t::WORLD_LIST;
+				mIsDcAwaitingList = false;
+				mIsInWorldList = true;
+			}
+			else if (mIsInWorldList && !mIsInWorld && htmlcxxutils::strCaseCmp(node.tagName(), "li"))
+			{
+				element = element_t::WORLD;
+				mIsInWorld = true;
+				mWorld = {};
+			}
+			else if (mIsInWorld)
+			{
+				if (!mWorld.hasName)
+				{
+					if (className == "world_name")
+					{
+						element = element_t::WORLD_NAME;
+						mCapture = capture_t::WORLD_NAME;
+					}
+				}
+				// the rest of the server data comes after the world name
+				else if (mWorld.isNameClosed)
+				{
+					if (!mWorld.hasLevel && className == "level")
+						mCapture = capture_t::LEVEL;
+					else if (!mWorld.hasBar && className == "bar")
+					{
+						element = element_t::BAR;
+						mWorld.hasBar = true;
+						mWorld.barValue += node.text();
+						mIsInBar = true;
+					}
+					else if (!mWorld.hasText && className == "text")
+						mCapture = capture_t::TEXT;
+				}
+			}
+		}
+		break;
+	default:
+		break;
+	}
+
+	// void tags never get closed, the dom builder flattens them so they have no children
+	if (!isVoidTag(node))
+		mOpenTags.push_back({ node.tagName(), element });
+}
+
+/**
+	@brief Called by htmlcxx for every text node
+
+	@param[in] node the text
+**/
+void FirmamentSaxParser::foundText(htmlcxx::HTML::Node node)
+{
+	if (mIsFailed || mPhase == phase_t::DONE) return;
+
+	if (mCapture != capture_t::NONE) store(node.text());
+	if (mIsInBar) mWorld.barValue += node.text();
+	if (mPhase == phase_t::IN_REGIONS && mOpenTags.size() == mRegionSelectDepth) mHasRegionSibling = true;
+}
+
+/**
+	@brief Called by htmlcxx for every comment, treated the same as text like the DOM walk does
+
+	@param[in] node the comment
+**/
+void FirmamentSaxParser::foundComment(htmlcxx::HTML::Node node)
+{
+	foundText(node);
+}
+
+/**
+	@brief Store the text of the first child of a tag we are interested in
+
+	@param[in] text the text of the first child node
+**/
+void FirmamentSaxParser::store(const std::string& text)
+{
+	capture_t capture = mCapture;
+	mCapture = capture_t::NONE;
+
+	switch (capture)
+	{
+	case capture_t::REGION_NAME:
+		if (text.length() > 0)
+			mServerHierarchy.push_back({ text, {} });
+		break;
+	case capture_t::DC_NAME:
+	{
+		auto& dc = mServerHierarchy.at(mRegionCount - 1).dc;
+
+		// error if dc is empty or repeated
+		if (text.length() == 0 || dc.find(text) != dc.end())
+		{
+			mIsFailed = true;
+			return;
+		}
+
+		dc.insert({ text, {} });
+		mDcName = text;
+		mIsDcAwaitingList = true;
+		break;
+	}
+	case capture_t::WORLD_NAME:
+		mWorld.name = text;
+		mWorld.hasName = true;
+		break;
+	case capture_t::LEVEL:
+		mWorld.level = text;
+		mWorld.hasLevel = true;
+		break;
+	case capture_t::TEXT:
+		mWorld.text = text;
+		mWorld.hasText = true;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+	@brief Close the most recent open tag with this name, and any tags opened after it
+
+	@param[in] node the closing tag
+**/
+void FirmamentSaxParser::closeTag(const htmlcxx::HTML::Node& node)
+{
+	const std::string name = node.tagName();
+	auto it = std::find_if(mOpenTags.rbegin(), mOpenTags.rend(),
+		[&name](const openTag_t& tag) { return htmlcxxutils::strCaseCmp(tag.name, name); });
+
+	// closing tags that were never opened are stored as comments by the htmlcxx dom builder
+	if (it == mOpenTags.rend())
+	{
+		foundText(node);
+		return;
+	}
+
+	// the tag we wanted the text of has no children
+	if (mCapture != capture_t::NONE) store("");
+
+	std::size_t depth = mOpenTags.size() - (it - mOpenTags.rbegin()) - 1;
+	while (mOpenTags.size() > depth && !mIsFailed)
+	{
+		element_t element = mOpenTags.back().element;
+		mOpenTags.pop_back();
+		closeElement(element);
+	}
+
+	// the parent of "report-region_select" is closed, there are no more regions
+	if (mPhase == phase_t::IN_REGIONS && mOpenTags.size() < mRegionSelectDepth)
+		mPhase = phase_t::DONE;
+}
+
+/**
+	@brief Finish up a tag we are interested in once it is closed
+
+	@param[in] element what the tag was
+**/
+void FirmamentSaxParser::closeElement(element_t element)
+{
+	switch (element)
+	{
+	case element_t::REGION_SELECT:
+		mPhase = phase_t::IN_REGIONS;
+		break;
+	case element_t::REGION:
+		// error if the last dc had no world list
+		if (mIsDcAwaitingList) mIsFailed = true;
+		mIsInRegion = false;
+		break;
+	case element_t::WORLD_LIST:
+		mIsInWorldList = false;
+		break;
+	case element_t::WORLD:
+		addWorld();
+		mIsInWorld = false;
+		break;
+	case element_t::WORLD_NAME:
+		mWorld.isNameClosed = true;
+		break;
+	case element_t::BAR:
+		mIsInBar = false;
+		break;
+	default:
+		break;
+	}
+}
+
+/**
+	@brief Check if a tag can never have children, like <br> or <img/>
+
+	@param[in] node the opening tag
+
+	@return true if the tag is void
+**/
+bool FirmamentSaxParser::isVoidTag(const htmlcxx::HTML::Node& node)
+{
+	static const std::set<std::string> voidTags = {
+		"area", "base", "br", "col", "embed", "hr", "img", "input",
+		"link", "meta", "param", "source", "track", "wbr" };
+
+	const std::string& text = node.text();
+	if (text.length() >= 2 && text.compare(text.length() - 2, 2, "/>") == 0) return true;
+
+	std::string name = node.tagName();
+	std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (char)tolower(c); });
+	return voidTags.find(name) != voidTags.end();
+}
+
+/**
+	@brief Find the end of a tag the same way htmlcxx does, quotes are only skipped after an '='
+
+	@param[in] html the html string
+	@param[in] pos position after the '<'
+
+	@return position after the '>', or npos if the tag is not complete yet
+**/
+std::size_t FirmamentSaxParser::findTagEnd(const std::string& html, std::size_t pos)
+{
+	while (pos < html.length() && html[pos] != '>')
+	{
+		if (html[pos++] != '=') continue;
+
+		while (pos < html.length() && isspace((unsigned char)html[pos])) pos++;
+		if (pos == html.length()) return std::string::npos;
+
+		if (html[pos] == '"' || html[pos] == '\'')
+		{
+			std::size_t quotePos = html.find(html[pos], pos + 1);
+			if (quotePos == std::string::npos) return std::string::npos;
+			pos = quotePos + 1;
+		}
+	}
+	if (pos == html.length()) return std::string::npos;
+
+	return pos + 1;
+}
+
+/**
+	@brief Find the last position in the html that htmlcxx can stop at and continue from later
+	without changing how the page is tokenized: right after a complete tag or comment, and never
+	inside a script or style block or text run.
+
+	@param[in] html the html string
+
+	@return number of characters that can be parsed now, 0 if none
+**/
+std::size_t FirmamentSaxParser::findSafeSplit(const std::string& html)
+{
+	// htmlcxx treats everything in these tags as text until the matching closing tag
+	static const std::set<std::string> literalTags = { "script", "style", "xmp", "plaintext", "textarea" };
+
+	std::size_t split = 0;
+	std::size_t pos = 0;
+	std::string literal = "";
+	while ((pos = html.find('<', pos)) != std::string::npos)
+	{
+		if (pos + 1 >= html.length()) break;
+		char next = html[pos + 1];
+
+		if (literal.length() > 0)
+		{
+			// look for the closing tag of the literal block
+			if (next != '/')
+			{
+				pos++;
+				continue;
+			}
+			if (pos + 2 + literal.length() > html.length()) break;
+			if (!htmlcxxutils::strCaseCmp(html.substr(pos + 2, literal.length()), literal))
+			{
+				pos++;
+				continue;
+			}
+			literal = "";
+		}
+
+		if (next == '!')
+		{
+			if (pos + 3 >= html.length()) break;
+			if (html.compare(pos + 2, 2, "--") == 0)
+			{
+				std::size_t endPos = html.find("-->", pos + 4);
+				if (endPos == std::string::npos) break;
+				pos = endPos + 3;
+				split = pos;
+				continue;
+			}
+		}
+		else if (!isalpha((unsigned char)next) && next != '/' && next != '?' && next != '%')
+		{
+			// not a tag, just text
+			pos++;
+			continue;
+		}
+
+		std::size_t endPos = findTagEnd(html, pos + 1);
+		if (endPos == std::string::npos) break;
+
+		if (isalpha((unsigned char)next))
+		{
+			std::size_t nameEnd = pos + 1;
+			while (nameEnd < endPos && isalnum((unsigned char)html[nameEnd])) nameEnd++;
+			std::string name = html.substr(pos + 1, nameEnd - pos - 1);
+			std::transform(name.begin(), name.end(), name.begin(), [](char c) { return (char)tolower(c); });
+			if (literalTags.find(name) != literalTags.end())
+				literal = name;
+		}
+
+		pos = endPos;
+		if (literal.length() == 0)
+			split = pos;
+	}
+
+	return split;
+}
+
+/**
+	@brief Store the server that was just read, skipped if the <li> was missing data
+**/
+void FirmamentSaxParser::addWorld()
+{
+	if (!mWorld.hasName || !mWorld.hasLevel || !mWorld.hasBar) return;
+
+	FirmamentTrackerHelper::restorationServerStatus_t status =
+		FirmamentTrackerHelper::makeServerStatus(mWorld.name, mWorld.level, mWorld.barValue, mWorld.text);
+
+	// error if server is repeated
+	if (mServerStatus.find(status.name) != mServerStatus.end())
+	{
+		mIsFailed = true;
+		return;
+	}
+
+	mServerStatus.insert({ status.name, status });
+	mServerHierarchy.at(mRegionCount - 1).dc.at(mDcName).servers.insert(status.name);
+}
@@ -0,0 +1,124 @@
+//==============================================================================
+/**
+@file       FirmamentSaxParser.h
+
+@brief		Single pass extractor for the firmament progress report page
+
+@copyright  (c) 2020, Momoko Tomoko
+
+**/
+//==============================================================================
+
+#pragma once
+
+#include "ParserSax.h"
+#include "FirmamentTrackerHelper.h"
+
+/**
+	@brief Extracts the server hierarchy and server status while the html is being tokenized,
+	without building the htmlcxx dom tree. Produces the same result as
+	FirmamentTrackerHelper::parseRestorationServerHtml.
+
+	The page can be given in pieces with feed() as it is downloaded, call finish() after the last piece.
+**/
+class FirmamentSaxParser : public htmlcxx::HTML::ParserSax
+{
+public:
+	FirmamentSaxParser(std::vector<FirmamentTrackerHelper::restorationRegion_t>& serverHierarchy,
+		std::unordered_map<std::string, FirmamentTrackerHelper::restorationServerStatus_t>& serverStatus);
+	~FirmamentSaxParser() {};
+
+	void feed(const char* data, std::size_t size);
+	void finish();
+	bool isSuccess() const;
+
+protected:
+	void foundTag(htmlcxx::HTML::Node node, bool isEnd) override;
+	void foundText(htmlcxx::HTML::Node node) override;
+	void foundComment(htmlcxx::HTML::Node node) override;
+
+private:
+	// where we are in the page
+	enum class phase_t
+	{
+		SEEK_REGION_SELECT, // looking for "report-region_select"
+		IN_REGION_SELECT, // reading region names from the <a> tags
+		IN_REGIONS, // going through the divs that are siblings of "report-region_select"
+		DONE
+	};
+
+	// what an open tag means to us, so we know what to finalize when it closes
+	enum class element_t
+	{
+		NONE,
+		REGION_SELECT,
+		REGION,
+		WORLD_LIST,
+		WORLD,
+		WORLD_NAME,
+		BAR
+	};
+
+	// which string the next child node's text gets stored into
+	enum class capture_t
+	{
+		NONE,
+		REGION_NAME,
+		DC_NAME,
+		WORLD_NAME,
+		LEVEL,
+		TEXT
+	};
+
+	struct openTag_t
+	{
+		std::string name;
+		element_t element;
+	};
+
+	// the server currently being read from an <li> tag
+	struct world_t
+	{
+		std::string name = "";
+		std::string level = "";
+		std::string barValue = "";
+		std::string text = "";
+		bool hasName = false;
+		bool isNameClosed = false;
+		bool hasLevel = false;
+		bool hasBar = false;
+		bool hasText = false;
+	};
+
+	std::vector<FirmamentTrackerHelper::restorationRegion_t>& mServerHierarchy;
+	std::unordered_map<std::string, FirmamentTrackerHelper::restorationServerStatus_t>& mServerStatus;
+
+	std::string mPending; // received html that can't be tokenized until more data arrives
+	bool mIsFinished = false;
+
+	std::vector<openTag_t> mOpenTags;
+	phase_t mPhase = phase_t::SEEK_REGION_SELECT;
+	capture_t mCapture = capture_t::NONE;
+	bool mIsFailed = false;
+
+	std::size_t mRegionSelectDepth = 0; // number of open tags above "report-region_select"
+	bool mHasRegionSibling = false; // the DOM walk fails if "report-region_select" has no siblings
+	std::size_t mRegionCount = 0; // number of region divs seen so far
+
+	bool mIsInRegion = false;
+	std::string mDcName = "";
+	bool mIsDcAwaitingList = false;
+	bool mIsInWorldList = false;
+	bool mIsInWorld = false;
+	bool mIsInBar = false; // all node text inside the bar tag is collected
+	world_t mWorld;
+
+	void store(const std::string& text);
+	void closeElement(element_t element);
+	void closeTag(const htmlcxx::HTML::Node& node);
+	void addWorld();
+
+	static bool isVoidTag(const htmlcxx::HTML::Node& node);
+	static std::size_t findTagEnd(const std::string& html, std::size_t pos);
+	static std::size_t findSafeSplit(const std::string& html);
+};
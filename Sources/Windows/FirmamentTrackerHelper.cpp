@@ -11,14 +11,18 @@
 
 #include "pch.h"
 #include "FirmamentTrackerHelper.h"
+#include "FirmamentSaxParser.h"
+
+//#define USE_DOM_PARSER // parse with the full htmlcxx dom tree instead of the single pass extractor
 
 FirmamentTrackerHelper::FirmamentTrackerHelper()
+	:mSnapshot(std::make_shared<const snapshot_t>())
 {
-	mHttpData.reset(new std::string());
 }
 
 /**
-	@brief Read the html page and store it into htmlData string
+	@brief Read the html page and parse out the server data. The result is published
+	as a new snapshot once the read is done.
 
 	@param[in] url url to html page
 
@@ -26,26 +30,84 @@ FirmamentTrackerHelper::FirmamentTrackerHelper()
 **/
 bool FirmamentTrackerHelper::readFirmamentHTML(const std::string & url)
 {
-	mHtmlMutex.lock();
+	mFetchMutex.lock();
+
+	std::shared_ptr<const snapshot_t> previous = mSnapshot.load();
+
+	// only ask the server for a 304 if what we have is a good read of this url
+	curlutils::validators_t requestValidators = {};
+	if (previous->isSuccess && url == mValidatorsUrl)
+		requestValidators = mValidators;
+	curlutils::validators_t responseValidators = {};
 
+	std::shared_ptr<snapshot_t> snapshot = std::make_shared<snapshot_t>();
+	long httpCode = 0;
+
+#ifdef USE_DOM_PARSER
 	// read html
-	bool isSuccess = curlutils::readHTML(url, mHttpData.get(), mHttpCode);
-	if (isSuccess)
+	std::string httpData;
+	bool isSuccess = mFetchClient.fetch(url, requestValidators, responseValidators,
+		[&httpData](const char* data, std::size_t size) { httpData.append(data, size); },
+		httpCode);
+	if (isSuccess && httpCode == 200)
 	{
 		// generate the dom tree
 		htmlcxx::HTML::ParserDom parser;
-		mDom = parser.parseTree(mHttpData.get()->c_str());
+		tree<htmlcxx::HTML::Node> dom = parser.parseTree(httpData);
+		htmlcxxutils::AttributeIndex index(dom);
+
+		isSuccess = parseRestorationServerHtml(snapshot->serverHierarchy, snapshot->serverStatus, dom, index);
+	}
+#else
+	// extract the server data from each piece of html as it is downloaded,
+	// without keeping the whole page or building the dom tree
+	FirmamentSaxParser parser(snapshot->serverHierarchy, snapshot->serverStatus);
+	bool isSuccess = mFetchClient.fetch(url, requestValidators, responseValidators,
+		[&parser](const char* data, std::size_t size) { parser.feed(data, size); },
+		httpCode);
+	if (isSuccess && httpCode == 200)
+	{
+		parser.finish();
+		isSuccess = parser.isSuccess();
+	}
+#endif
+
+	bool isNotModified = isSuccess && httpCode == 304 && requestValidators.etag.length() + requestValidators.lastModified.length() > 0;
+	if (isNotModified)
+	{
+		// the page did not change, keep the data we already have
+		*snapshot = *previous;
+	}
+	else
+	{
+		snapshot->httpCode = httpCode;
+		snapshot->isSuccess = isSuccess;
+		snapshot->contentHash = isSuccess ? hashServerStatus(snapshot->serverStatus) : 0;
 
-		isSuccess = parseRestorationServerHtml(mServerHierarchy, mServerStatus, mDom);
+		// remember the validators of a good read for the next request
+		mValidators = isSuccess ? responseValidators : curlutils::validators_t{};
+		mValidatorsUrl = isSuccess ? url : "";
 	}
+	snapshot->isRead = true;
+	snapshot->fetchStats = mFetchClient.getLastStats();
 
-	mIsSuccess = isSuccess;
+	mSnapshot.store(std::move(snapshot));
 
-	mHtmlMutex.unlock();
+	mFetchMutex.unlock();
 
 	return isSuccess;
 }
 
+/**
+	@brief Get the result of the latest read
+
+	@return snapshot of the latest read, stays valid while held
+**/
+std::shared_ptr<const FirmamentTrackerHelper::snapshot_t> FirmamentTrackerHelper::getSnapshot() const
+{
+	return mSnapshot.load();
+}
+
 /**
 	@brief Check to see if the html read was good
 
@@ -53,11 +115,17 @@ bool FirmamentTrackerHelper::readFirmamentHTML(const std::string & url)
 **/
 bool FirmamentTrackerHelper::isHtmlGood()
 {
-	mHtmlMutex.lock();
-	bool isSuccess = mIsSuccess;
-	mHtmlMutex.unlock();
+	return mSnapshot.load()->isSuccess;
+}
 
-	return isSuccess;
+/**
+	@brief Get the timings of the last html read
+
+	@return fetch stats
+**/
+CurlFetchClient::fetchStats_t FirmamentTrackerHelper::getFetchStats()
+{
+	return mSnapshot.load()->fetchStats;
 }
 
 /**
@@ -67,11 +135,7 @@ bool FirmamentTrackerHelper::isHtmlGood()
 **/
 std::vector<FirmamentTrackerHelper::restorationRegion_t> FirmamentTrackerHelper::getServerHierarchy()
 {
-	mHtmlMutex.lock();
-	std::vector<restorationRegion_t> serverHierarchy = mServerHierarchy;
-	mHtmlMutex.unlock();
-
-	return serverHierarchy;
+	return mSnapshot.load()->serverHierarchy;
 }
 
 /**
@@ -85,20 +149,25 @@ std::vector<FirmamentTrackerHelper::restorationRegion_t> FirmamentTrackerHelper:
 const FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::getFirmamentStatus(const std::string & server)
 {
 	restorationServerStatus_t status;
-	mHtmlMutex.lock();
-	if (mHttpCode == 200)
+	std::shared_ptr<const snapshot_t> snapshot = mSnapshot.load();
+	if (!snapshot->isRead)
+	{
+		// first read is still in progress
+		status.progress = "Loading";
+	}
+	else if (snapshot->httpCode == 200)
 	{
-		if (mServerStatus.find(server) != mServerStatus.end())
-			status = mServerStatus.at(server);
+		auto statusIt = snapshot->serverStatus.find(server);
+		if (statusIt != snapshot->serverStatus.end())
+			status = statusIt->second;
 		else
 			// http was good but could not parse page for server info
 			status.progress = "No Data";
 	}
 	else {
 		// http read was bad
-		status.progress = "Error: " + std::to_string(mHttpCode);
+		status.progress = "Error: " + std::to_string(snapshot->httpCode);
 	}
-	mHtmlMutex.unlock();
 
 	return status;
 }
@@ -108,36 +177,74 @@ const FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::
 
 	@param[in] liIt iterator to the <li> block to parse
 	@param[in] dom the parsed html document object model tree
+	@param[in] index attribute index of dom
 
 	@return restorationServerStatus_t struct
 */
 FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::parseServerData(tree<htmlcxx::HTML::Node>::post_order_iterator liIt,
-	tree<htmlcxx::HTML::Node>& dom)
+	tree<htmlcxx::HTML::Node>& dom, const htmlcxxutils::AttributeIndex& index)
 {
 	restorationServerStatus_t status = {};
 
 	// parse world name
-	auto worldNameIt = htmlcxxutils::htmlcxxFindNextAttribute("class", "world_name", liIt.begin(), liIt.end());
+	auto worldNameIt = index.findNextAttribute("class", "world_name", liIt.begin(), liIt.end());
 	if (worldNameIt == htmlcxxutils::pre_order_it(liIt.end())) return status;
 	std::string worldName = dom.child(worldNameIt, 0)->text();
 
 	// parse level
-	auto levelIt = htmlcxxutils::htmlcxxFindNextAttribute("class", "level", worldNameIt.end(), liIt.end());
+	auto levelIt = index.findNextAttribute("class", "level", worldNameIt.end(), liIt.end());
 	if (levelIt == htmlcxxutils::pre_order_it(liIt.end())) return status;
 	std::string level = dom.child(levelIt, 0)->text();
 
 	// parse bar value
-	auto barIt = htmlcxxutils::htmlcxxFindNextAttribute("class", "bar", worldNameIt.end(), liIt.end());
+	auto barIt = index.findNextAttribute("class", "bar", worldNameIt.end(), liIt.end());
 	if (barIt == htmlcxxutils::pre_order_it(liIt.end())) return status;
 	std::string barValue;
 	for (auto it = barIt; it != htmlcxxutils::pre_order_it(barIt.end()); it++)
 		barValue += it->text();
 
 	// parse text
-	auto textIt = htmlcxxutils::htmlcxxFindNextAttribute("class", "text", worldNameIt.end(), liIt.end());
+	auto textIt = index.findNextAttribute("class", "text", worldNameIt.end(), liIt.end());
 	std::string text = "";
 	if (textIt != htmlcxxutils::pre_order_it(liIt.end())) text = dom.child(textIt, 0)->text();
 
+	status = makeServerStatus(worldName, level, barValue, text);
+	return status;
+}
+
+/*
+	@brief Hash the parsed server status, the markup around it doesn't change the hash
+
+	@param[in] serverStatus the parsed server status
+
+	@return hash of the content
+*/
+std::size_t FirmamentTrackerHelper::hashServerStatus(const std::unordered_map<std::string, restorationServerStatus_t>& serverStatus)
+{
+	// add the hashes of each server so the map's order doesn't matter
+	std::hash<std::string> hasher;
+	std::size_t hash = serverStatus.size();
+	for (const auto& status : serverStatus)
+	{
+		const restorationServerStatus_t& server = status.second;
+		hash += hasher(server.name + '\n' + server.progress + '\n' + server.level + '\n' + server.text);
+	}
+	return hash;
+}
+
+/*
+	@brief Convert the parsed strings of a server into its status
+
+	@param[in] worldName name of the server
+	@param[in] level firmament level
+	@param[in] barValue raw html of the progress bar
+	@param[in] text description text
+
+	@return restorationServerStatus_t struct
+*/
+FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::makeServerStatus(const std::string& worldName,
+	const std::string& level, const std::string& barValue, const std::string& text)
+{
 	// convert bar value to progress
 	std::string progress = "nan";
 	float progressF = 0.0;
@@ -168,8 +275,7 @@ FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::parseS
 			}
 		}
 	}
-	status = { worldName, progress, level, text, progressF, true };
-	return status;
+	return { worldName, progress, level, text, progressF, true };
 }
 
 /*
@@ -178,12 +284,13 @@ FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::parseS
 	@param[out] serverHierarchy how the servers are organized
 	@param[out] serverStatus parsed info for each server
 	@param[in] dom the parsed html document object model tree
+	@param[in] index attribute index of dom
 
 	@return true if success
 */
 bool FirmamentTrackerHelper::parseRestorationServerHtml(std::vector<restorationRegion_t>& serverHierarchy,
 	std::unordered_map<std::string, restorationServerStatus_t>& serverStatus,
-	tree<htmlcxx::HTML::Node>& dom)
+	tree<htmlcxx::HTML::Node>& dom, const htmlcxxutils::AttributeIndex& index)
 {
 	serverHierarchy.clear();
 	serverStatus.clear();
@@ -191,7 +298,7 @@ bool FirmamentTrackerHelper::parseRestorationServerHtml(std::vector<restorationR
 	// load the region names into vector
 	// the region names are in the html before everything else, hence we have
 	// to gather the names here first
-	auto regionIt = htmlcxxutils::htmlcxxFindNextAttribute("class", "report-region_select", dom.begin(), dom.end());
+	auto regionIt = index.findNextAttribute("class", "report-region_select", dom.begin(), dom.end());
 
 	if (regionIt == dom.end()) return false;
 
@@ -224,9 +331,9 @@ bool FirmamentTrackerHelper::parseRestorationServerHtml(std::vector<restorationR
 		if (dataIt == serverHierarchy.end()) return false;
 
 		// go through the div looking for the attribute "report-dc_name" for the dc's
-		for (auto dcIt = htmlcxxutils::htmlcxxFindNextAttribute("class", "report-dc_name", nextRegionIt.begin(), nextRegionIt.end());
+		for (auto dcIt = index.findNextAttribute("class", "report-dc_name", nextRegionIt.begin(), nextRegionIt.end());
 			dcIt != htmlcxxutils::pre_order_it(nextRegionIt.end());
-			dcIt = htmlcxxutils::htmlcxxFindNextAttribute("class", "report-dc_name", dcIt.begin(), nextRegionIt.end()))
+			dcIt = index.findNextAttribute("class", "report-dc_name", dcIt.begin(), nextRegionIt.end()))
 		{
 			std::string dcName = dom.child(dcIt, 0)->text();
 			if (dcName.length() == 0) return false;
@@ -238,7 +345,7 @@ bool FirmamentTrackerHelper::parseRestorationServerHtml(std::vector<restorationR
 
 			// The worlds in the dc are listed under the tag with class "report-world_list".
 			// They are stored under the "li" tags
-			auto worldListIt = htmlcxxutils::htmlcxxFindNextAttribute("class", "report-world_list", dcIt.begin(), nextRegionIt.end());
+			auto worldListIt = index.findNextAttribute("class", "report-world_list", dcIt.begin(), nextRegionIt.end());
 			if (worldListIt == htmlcxxutils::pre_order_it(nextRegionIt.end())) return false;
 
 			// go through each "li" tag and parse out the info we need
@@ -246,7 +353,7 @@ bool FirmamentTrackerHelper::parseRestorationServerHtml(std::vector<restorationR
 				liIt != htmlcxxutils::pre_order_it(worldListIt.end());
 				liIt = htmlcxxutils::htmlcxxFindNextTag("li", liIt.end(), worldListIt.end()))
 			{
-				restorationServerStatus_t status = parseServerData(liIt, dom);
+				restorationServerStatus_t status = parseServerData(liIt, dom, index);
 
 				if (status.isValid)
 				{
@@ -270,10 +377,12 @@ bool FirmamentTrackerHelper::parseRestorationServerHtml(std::vector<restorationR
 
 	@param[in] server the server to gather data for
 	@param[in] dom the parsed html document object model tree
+	@param[in] index attribute index of dom
 
 	@return restoration status
 */
-FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::parseServerStatus(const std::string& server, tree<htmlcxx::HTML::Node>& dom)
+FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::parseServerStatus(const std::string& server, tree<htmlcxx::HTML::Node>& dom,
+	const htmlcxxutils::AttributeIndex& index)
 {
 	for (auto it = dom.begin(); it != dom.end(); it++)
 	{
@@ -289,7 +398,7 @@ FirmamentTrackerHelper::restorationServerStatus_t FirmamentTrackerHelper::parseS
 
 				if (!liIt->isTag() || !htmlcxxutils::strCaseCmp(liIt->tagName(), "li")) return {};
 
-				restorationServerStatus_t status = parseServerData(liIt, dom);
+				restorationServerStatus_t status = parseServerData(liIt, dom, index);
 
 				if (!status.isValid) return {};
 
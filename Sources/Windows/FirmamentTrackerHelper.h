@@ -12,8 +12,10 @@
 #pragma once
 
 #include <mutex>
+#include <atomic>
+#include <memory>
 #include "HtmlcxxUtils.hpp"
-#include "CurlUtils.hpp"
+#include "CurlFetchClient.h"
 
 class FirmamentTrackerHelper
 {
@@ -43,32 +45,51 @@ public:
 		bool isValid = false;
 	};
 
+	// result of one html read, never modified after it is published so readers can keep using it
+	// while the next read is in progress
+	struct snapshot_t
+	{
+		// the html doesn't wrap the regions, it's just in order that it appears,
+		// so don't use unordered_map here since we need to preserve the order we loaded the regions
+		std::vector<restorationRegion_t> serverHierarchy = {};
+		std::unordered_map<std::string, restorationServerStatus_t> serverStatus = {};
+		long httpCode = 0; // error code from curl after downloading html string
+		bool isSuccess = false; // status of the read
+		bool isRead = false; // false until the first read completes
+		std::size_t contentHash = 0; // hash of the parsed server status, changes when the page's content does
+		CurlFetchClient::fetchStats_t fetchStats = {};
+	};
+
 	FirmamentTrackerHelper();
 	~FirmamentTrackerHelper() {};
 
 	const restorationServerStatus_t getFirmamentStatus(const std::string& server);
 	bool readFirmamentHTML(const std::string& url);
 	bool isHtmlGood();
+	CurlFetchClient::fetchStats_t getFetchStats();
+	std::shared_ptr<const snapshot_t> getSnapshot() const;
 
 	std::vector<FirmamentTrackerHelper::restorationRegion_t> getServerHierarchy();
 
-private:
-	std::unique_ptr<std::string> mHttpData; // raw html string
-	long mHttpCode = 0; // error code from curl after downloading html string
-	tree<htmlcxx::HTML::Node> mDom; // tree structure for parsed html data
-	bool mIsSuccess = false; // status of previous read
+	static std::size_t hashServerStatus(const std::unordered_map<std::string, restorationServerStatus_t>& serverStatus);
+	static restorationServerStatus_t makeServerStatus(const std::string& worldName, const std::string& level,
+		const std::string& barValue, const std::string& text);
 
-	std::mutex mHtmlMutex;
+private:
+	// the latest read, swapped in whole so readers never wait on a read in progress
+	std::atomic<std::shared_ptr<const snapshot_t>> mSnapshot;
 
-	// the html doesn't wrap the regions, it's just in order that it appears,
-	// so don't use unordered_map here since we need to preserve the order we loaded the regions
-	std::vector<restorationRegion_t> mServerHierarchy = {};
-	std::unordered_map<std::string, restorationServerStatus_t> mServerStatus;
+	// only one read at a time, the members below are only used while holding it
+	std::mutex mFetchMutex;
+	curlutils::validators_t mValidators; // cache validators of the previous good read
+	std::string mValidatorsUrl = ""; // url the validators belong to
+	CurlFetchClient mFetchClient; // keeps the connection open between reads
 
-	restorationServerStatus_t parseServerStatus(const std::string& server, tree<htmlcxx::HTML::Node>& dom);
+	restorationServerStatus_t parseServerStatus(const std::string& server, tree<htmlcxx::HTML::Node>& dom,
+											const htmlcxxutils::AttributeIndex& index);
 	restorationServerStatus_t parseServerData(tree<htmlcxx::HTML::Node>::post_order_iterator liIt,
-											tree<htmlcxx::HTML::Node>& dom);
+											tree<htmlcxx::HTML::Node>& dom, const htmlcxxutils::AttributeIndex& index);
 	bool parseRestorationServerHtml(std::vector<restorationRegion_t>& serverHierarchy,
 		std::unordered_map<std::string, restorationServerStatus_t>& serverStatus,
-		tree<htmlcxx::HTML::Node>& dom);
+		tree<htmlcxx::HTML::Node>& dom, const htmlcxxutils::AttributeIndex& index);
 };
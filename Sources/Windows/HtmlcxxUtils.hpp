@@ -9,6 +9,9 @@
 #pragma once
 #include "ParserDom.h"
 #include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
 
 namespace htmlcxxutils
 {
@@ -22,6 +25,7 @@ namespace htmlcxxutils
 	*/
 	static bool strCaseCmp(const std::string& a, const std::string& b)
 	{
+		if (a.length() != b.length()) return false;
 		return std::equal(a.begin(), a.end(), b.begin(),
 			[](char a, char b) {
 				return tolower(a) == tolower(b);
@@ -57,6 +61,81 @@ namespace htmlcxxutils
 		return it;
 	}
 
+	/*
+		@brief Index of the tags by attribute, built with one walk over the tree after it is parsed
+
+		Every tag's attributes are parsed once while building, after that finding the next tag with
+		an attribute value is a binary search over the positions of the tags with that value instead
+		of a walk over the range that parses the attributes of every tag again.
+		The tree must not change while the index is used.
+	*/
+	class AttributeIndex
+	{
+	public:
+		typedef tree<htmlcxx::HTML::Node> tree_t;
+
+		/*
+			@brief Build the index
+
+			@param[in] dom the parsed tree, its tags get their attributes parsed
+		*/
+		explicit AttributeIndex(tree_t& dom)
+		{
+			for (auto it = dom.begin(); it != dom.end(); it++)
+			{
+				const std::size_t position = mNodes.size();
+				mNodes.push_back(it);
+				mPositions.emplace(it.node, position);
+
+				if (!it->isTag()) continue;
+				it->parseAttributes();
+				for (const auto& attribute : it->attributes())
+				{
+					// walking in pre-order keeps every list sorted
+					mTags[attribute.first][attribute.second].push_back(position);
+				}
+			}
+		}
+
+		/*
+			@brief Find the first tag in the range with attribute name and value,
+			same result as htmlcxxFindNextAttribute
+
+			@param[in] name name of attribute
+			@param[in] value value of attribute
+			@param[in] begin start of range
+			@param[in] end end of range
+
+			@return iterator to first match or end if not found
+		*/
+		tree_t::pre_order_iterator findNextAttribute(const std::string& name, const std::string& value,
+			tree_t::pre_order_iterator begin,
+			tree_t::pre_order_iterator end) const
+		{
+			auto nameIt = mTags.find(name);
+			if (nameIt == mTags.end()) return end;
+			auto valueIt = nameIt->second.find(value);
+			if (valueIt == nameIt->second.end()) return end;
+
+			const std::vector<std::size_t>& positions = valueIt->second;
+			auto match = std::lower_bound(positions.begin(), positions.end(), position(begin));
+			if (match == positions.end() || *match >= position(end)) return end;
+			return mNodes[*match];
+		}
+
+	private:
+		// position of the node in pre-order, the end of the tree is after the last node
+		std::size_t position(const tree_t::pre_order_iterator& it) const
+		{
+			auto positionIt = mPositions.find(it.node);
+			return positionIt == mPositions.end() ? mNodes.size() : positionIt->second;
+		}
+
+		std::vector<tree_t::pre_order_iterator> mNodes; // every node in pre-order
+		std::unordered_map<const void*, std::size_t> mPositions; // by node of the iterator
+		std::unordered_map<std::string, std::unordered_map<std::string, std::vector<std::size_t>>> mTags; // name, value, positions
+	};
+
 	/*
 		@brief Find in htmlcxx tree for next iterator with matching tag
 
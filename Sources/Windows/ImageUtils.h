@@ -7,30 +7,333 @@
 //==============================================================================
 
 #pragma once
+
 #include <string>
+#include <vector>
+#include <cstddef>
+#include <algorithm> // for min, max
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define IMAGEUTILS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define IMAGEUTILS_TARGET(isa)
+#else
+#include <cpuid.h>
+#define IMAGEUTILS_TARGET(isa) __attribute__((target(isa)))
+#endif
+#endif
 
 namespace imageutils
 {
 	static const std::string BASE64 = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
 
 	/**
-		@brief converts loaded png into base64. Function obtained from lodepng example documentation
+		@brief base64 encodes with a table lookup per character, handles the padding at the end
+
+		@param[out] out the output, 4 * ((size + 2) / 3) characters are written
+		@param[in] in the input bytes
+		@param[in] size number of input bytes
+	**/
+	inline void base64EncodeScalar(char* out, const unsigned char* in, std::size_t size)
+	{
+		const char* table = BASE64.data();
+		std::size_t i = 0;
+		for (; i + 3 <= size; i += 3)
+		{
+			unsigned int v = (in[i] << 16) | (in[i + 1] << 8) | in[i + 2];
+			*out++ = table[(v >> 18) & 0x3f];
+			*out++ = table[(v >> 12) & 0x3f];
+			*out++ = table[(v >> 6) & 0x3f];
+			*out++ = table[v & 0x3f];
+		}
+
+		if (i < size)
+		{
+			unsigned int v = in[i] << 16;
+			if (i + 1 < size) v |= in[i + 1] << 8;
+			*out++ = table[(v >> 18) & 0x3f];
+			*out++ = table[(v >> 12) & 0x3f];
+			*out++ = (i + 1 < size) ? table[(v >> 6) & 0x3f] : '=';
+			*out++ = '=';
+		}
+	}
+
+#ifdef IMAGEUTILS_X86
+	/**
+		@brief Turns the first 12 bytes of a 16 byte load into 16 base64 characters.
+		The bytes of each 3 byte group are unpacked into four 6 bit indices with multiplies,
+		then each index gets the offset of its range of the alphabet added to it.
+	**/
+	IMAGEUTILS_TARGET("ssse3")
+	inline __m128i base64Encode12(__m128i in)
+	{
+		in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+		const __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+		const __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+		const __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+		const __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+		const __m128i indices = _mm_or_si128(t1, t3);
+
+		// 0-25 'A', 26-51 'a', 52-61 '0', 62 '+', 63 '/'
+		__m128i range = _mm_subs_epu8(indices, _mm_set1_epi8(51));
+		const __m128i isUpper = _mm_cmpgt_epi8(_mm_set1_epi8(26), indices);
+		range = _mm_or_si128(range, _mm_and_si128(isUpper, _mm_set1_epi8(13)));
+		const __m128i offsets = _mm_setr_epi8('a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+		return _mm_add_epi8(_mm_shuffle_epi8(offsets, range), indices);
+	}
+
+	IMAGEUTILS_TARGET("ssse3")
+	inline void base64EncodeSSSE3(char* out, const unsigned char* in, std::size_t size)
+	{
+		// loads are 16 bytes wide for 12 bytes of input
+		std::size_t i = 0;
+		for (; i + 16 <= size; i += 12, out += 16)
+		{
+			__m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			_mm_storeu_si128(reinterpret_cast<__m128i*>(out), base64Encode12(block));
+		}
+		base64EncodeScalar(out, in + i, size - i);
+	}
+
+	/**
+		@brief The same steps as base64Encode12 on both 128 bit lanes, 24 bytes into 32 characters
+	**/
+	IMAGEUTILS_TARGET("avx2")
+	inline __m256i base64Encode24(__m256i in)
+	{
+		in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+			10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+			10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+
+		const __m256i t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+		const __m256i t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+		const __m256i t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+		const __m256i t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+		const __m256i indices = _mm256_or_si256(t1, t3);
+
+		__m256i range = _mm256_subs_epu8(indices, _mm256_set1_epi8(51));
+		const __m256i isUpper = _mm256_cmpgt_epi8(_mm256_set1_epi8(26), indices);
+		range = _mm256_or_si256(range, _mm256_and_si256(isUpper, _mm256_set1_epi8(13)));
+		const __m256i offsets = _mm256_setr_epi8(
+			'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0,
+			'a' - 26, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52, '0' - 52,
+			'0' - 52, '0' - 52, '0' - 52, '+' - 62, '/' - 63, 'A', 0, 0);
+		return _mm256_add_epi8(_mm256_shuffle_epi8(offsets, range), indices);
+	}
+
+	IMAGEUTILS_TARGET("avx2")
+	inline void base64EncodeAVX2(char* out, const unsigned char* in, std::size_t size)
+	{
+		// each lane loads 16 bytes for 12 bytes of input, the upper lane starts 12 bytes in
+		std::size_t i = 0;
+		for (; i + 28 <= size; i += 24, out += 32)
+		{
+			__m128i low = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+			__m128i high = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12));
+			__m256i block = _mm256_inserti128_si256(_mm256_castsi128_si256(low), high, 1);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), base64Encode24(block));
+		}
+		base64EncodeSSSE3(out, in + i, size - i);
+	}
+
+	/**
+		@brief Checks which instruction sets the cpu and os support
+
+		@return 2 for AVX2, 1 for SSSE3, 0 for neither
+	**/
+	inline int detectSimdLevel()
+	{
+		unsigned int info[4] = {};
+#ifdef _MSC_VER
+		__cpuid(reinterpret_cast<int*>(info), 0);
+#else
+		__cpuid(0, info[0], info[1], info[2], info[3]);
+#endif
+		unsigned int maxLeaf = info[0];
+		if (maxLeaf < 1)
+			return 0;
+
+#ifdef _MSC_VER
+		__cpuid(reinterpret_cast<int*>(info), 1);
+#else
+		__cpuid(1, info[0], info[1], info[2], info[3]);
+#endif
+		bool hasSSSE3 = (info[2] & (1 << 9)) != 0;
+		bool hasOSXSave = (info[2] & (1 << 27)) != 0;
+		bool hasAVX = (info[2] & (1 << 28)) != 0;
+		if (!hasSSSE3)
+			return 0;
+
+		// AVX2 also needs the os to save the ymm registers
+		if (maxLeaf < 7 || !hasOSXSave || !hasAVX)
+			return 1;
+#ifdef _MSC_VER
+		unsigned long long xcr0 = _xgetbv(0);
+		__cpuidex(reinterpret_cast<int*>(info), 7, 0);
+#else
+		unsigned int xcr0Low = 0;
+		unsigned int xcr0High = 0;
+		__asm__("xgetbv" : "=a"(xcr0Low), "=d"(xcr0High) : "c"(0));
+		unsigned long long xcr0 = xcr0Low;
+		__cpuid_count(7, 0, info[0], info[1], info[2], info[3]);
+#endif
+		bool hasAVX2 = (info[1] & (1 << 5)) != 0;
+		return ((xcr0 & 0x6) == 0x6 && hasAVX2) ? 2 : 1;
+	}
+#endif
+
+	/**
+		@brief base64 encodes with the widest instruction set the cpu supports, chosen on the first call
+
+		@param[out] out the output, 4 * ((size + 2) / 3) characters are written
+		@param[in] in the input bytes
+		@param[in] size number of input bytes
+	**/
+	inline void base64Encode(char* out, const unsigned char* in, std::size_t size)
+	{
+		typedef void (*encoder_t)(char*, const unsigned char*, std::size_t);
+#ifdef IMAGEUTILS_X86
+		static const encoder_t encoder = []()
+		{
+			switch (detectSimdLevel())
+			{
+			case 2: return (encoder_t)base64EncodeAVX2;
+			case 1: return (encoder_t)base64EncodeSSSE3;
+			default: return (encoder_t)base64EncodeScalar;
+			}
+		}();
+#else
+		static const encoder_t encoder = base64EncodeScalar;
+#endif
+		encoder(out, in, size);
+	}
+
+	// colour with straight alpha
+	struct rgba_t
+	{
+		unsigned char r = 0;
+		unsigned char g = 0;
+		unsigned char b = 0;
+		unsigned char a = 0;
+	};
+
+	// decoded image, 4 bytes per pixel in RGBA order, rows top to bottom
+	struct rgbaImage_t
+	{
+		unsigned int width = 0;
+		unsigned int height = 0;
+		std::vector<unsigned char> pixels;
+	};
+
+	/**
+		@brief draws a colour over a pixel
+
+		@param[in,out] pixel the 4 bytes of the pixel
+		@param[in] color the colour to draw
+	**/
+	inline void blendPixel(unsigned char* pixel, const rgba_t& color)
+	{
+		int srcA = color.a;
+		int dstA = pixel[3] * (255 - srcA) / 255;
+		int outA = srcA + dstA;
+		if (outA == 0)
+			return;
+
+		pixel[0] = (unsigned char)((color.r * srcA + pixel[0] * dstA) / outA);
+		pixel[1] = (unsigned char)((color.g * srcA + pixel[1] * dstA) / outA);
+		pixel[2] = (unsigned char)((color.b * srcA + pixel[2] * dstA) / outA);
+		pixel[3] = (unsigned char)outA;
+	}
+
+	/**
+		@brief draws a rectangle over an image, clipped to the image
+
+		@param[in,out] image the image to draw on
+		@param[in] x left edge
+		@param[in] y top edge
+		@param[in] width width of the rectangle
+		@param[in] height height of the rectangle
+		@param[in] color the colour to draw
+	**/
+	inline void fillRect(rgbaImage_t& image, int x, int y, int width, int height, const rgba_t& color)
+	{
+		int left = (std::max)(x, 0);
+		int top = (std::max)(y, 0);
+		int right = (std::min)(x + width, (int)image.width);
+		int bottom = (std::min)(y + height, (int)image.height);
+		for (int row = top; row < bottom; row++)
+		{
+			unsigned char* pixel = &image.pixels[(row * image.width + left) * 4];
+			for (int column = left; column < right; column++, pixel += 4)
+				blendPixel(pixel, color);
+		}
+	}
+
+	// 3x5 digit glyphs, one row per entry, the high bit is the left column
+	static const unsigned char DIGIT_GLYPHS[10][5] = {
+		{ 7, 5, 5, 5, 7 }, { 2, 6, 2, 2, 7 }, { 7, 1, 7, 4, 7 }, { 7, 1, 7, 1, 7 }, { 5, 5, 7, 1, 1 },
+		{ 7, 4, 7, 1, 7 }, { 7, 4, 7, 5, 7 }, { 7, 1, 1, 1, 1 }, { 7, 5, 7, 5, 7 }, { 7, 5, 7, 1, 7 }
+	};
+
+	/**
+		@brief gets the size of digits drawn by drawDigits
+
+		@param[in] digits the digits to draw
+		@param[in] scale size of a glyph pixel
+		@param[out] width width of the text
+		@param[out] height height of the text
+	**/
+	inline void measureDigits(const std::string& digits, int scale, int& width, int& height)
+	{
+		width = digits.empty() ? 0 : ((int)digits.size() * 4 - 1) * scale;
+		height = 5 * scale;
+	}
+
+	/**
+		@brief draws digits with the built in 3x5 font, other characters are skipped
+
+		@param[in,out] image the image to draw on
+		@param[in] x left edge
+		@param[in] y top edge
+		@param[in] scale size of a glyph pixel
+		@param[in] digits the digits to draw
+		@param[in] color the colour to draw
+	**/
+	inline void drawDigits(rgbaImage_t& image, int x, int y, int scale, const std::string& digits, const rgba_t& color)
+	{
+		for (const auto& digit : digits)
+		{
+			if (digit < '0' || digit > '9')
+				continue;
+
+			const unsigned char* glyph = DIGIT_GLYPHS[digit - '0'];
+			for (int row = 0; row < 5; row++)
+				for (int column = 0; column < 3; column++)
+					if (glyph[row] & (4 >> column))
+						fillRect(image, x + column * scale, y + row * scale, scale, scale, color);
+			x += 4 * scale;
+		}
+	}
+
+	/**
+		@brief converts loaded png into base64, appending it to out
 
 		@param[out] out the output base 64
 		@param[in] in the input image
 	**/
-	template<typename T, typename U> //T and U can be std::string or std::vector<unsigned char>//T and U can be std::string or std::vector<unsigned char>
+	template<typename T, typename U> //T and U can be std::string or std::vector<unsigned char>
 	void pngToBase64(T& out, const U& in) {
-		for (size_t i = 0; i < in.size(); i += 3) {
-			int v = 65536 * in[i];
-			if (i + 1 < in.size()) v += 256 * in[i + 1];
-			if (i + 2 < in.size()) v += in[i + 2];
-			out.push_back(BASE64[(v >> 18) & 0x3f]);
-			out.push_back(BASE64[(v >> 12) & 0x3f]);
-			if (i + 1 < in.size()) out.push_back(BASE64[(v >> 6) & 0x3f]);
-			else out.push_back('=');
-			if (i + 2 < in.size()) out.push_back(BASE64[(v >> 0) & 0x3f]);
-			else out.push_back('=');
-		}
+		if (in.size() == 0)
+			return;
+
+		// size the output once and write straight into it
+		std::size_t start = out.size();
+		out.resize(start + 4 * ((in.size() + 2) / 3));
+		base64Encode(reinterpret_cast<char*>(&out[start]), reinterpret_cast<const unsigned char*>(&in[0]), in.size());
 	}
-}
\ No newline at end of file
+}
@@ -0,0 +1,106 @@
+//==============================================================================
+/**
+@file       LatencyHistogram.h
+@brief      Histogram of how long event handlers take to run
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+/**
+	@brief Counts durations into power of two microsecond buckets. Recording is lock free
+	so it can be used from any thread.
+**/
+class LatencyHistogram
+{
+public:
+	// bucket i counts durations below 2^i microseconds, the last bucket counts everything longer
+	static const int BUCKET_COUNT = 28;
+
+	/**
+		@brief Records the time from construction to destruction into a histogram
+	**/
+	class ScopedTimer
+	{
+	public:
+		ScopedTimer(LatencyHistogram& histogram)
+			:mHistogram(histogram),
+			mStart(std::chrono::steady_clock::now())
+		{
+		}
+
+		~ScopedTimer()
+		{
+			mHistogram.record(std::chrono::steady_clock::now() - mStart);
+		}
+
+	private:
+		LatencyHistogram& mHistogram;
+		const std::chrono::steady_clock::time_point mStart;
+	};
+
+	/**
+		@brief Add a duration to the histogram
+
+		@param[in] duration the duration to add
+	**/
+	void record(std::chrono::steady_clock::duration duration)
+	{
+		long long us = std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
+		int bucket = 0;
+		while (bucket < BUCKET_COUNT - 1 && us >= (1LL << bucket))
+			bucket++;
+
+		mBuckets[bucket]++;
+		mCount++;
+
+		long long max = mMaxUs;
+		while (us > max && !mMaxUs.compare_exchange_weak(max, us)) {}
+	}
+
+	/**
+		@brief Get the duration that a percentage of the recorded durations are below
+
+		@param[in] percentile 0 to 100
+
+		@return upper bound of the bucket containing the percentile, in microseconds
+	**/
+	long long getPercentileUs(double percentile) const
+	{
+		unsigned long long count = mCount;
+		if (count == 0) return 0;
+
+		unsigned long long target = (unsigned long long)(count * percentile / 100.0);
+		unsigned long long seen = 0;
+		for (int i = 0; i < BUCKET_COUNT; i++)
+		{
+			seen += mBuckets[i];
+			if (seen > target)
+				return (i < BUCKET_COUNT - 1) ? (1LL << i) : mMaxUs.load();
+		}
+		return mMaxUs;
+	}
+
+	/**
+		@brief Format a summary for logging
+
+		@return one line summary of the histogram
+	**/
+	std::string format() const
+	{
+		return "count " + std::to_string(mCount.load()) +
+			", p50 < " + std::to_string(getPercentileUs(50)) + "us" +
+			", p99 < " + std::to_string(getPercentileUs(99)) + "us" +
+			", max " + std::to_string(mMaxUs.load()) + "us";
+	}
+
+private:
+	std::atomic<unsigned long long> mBuckets[BUCKET_COUNT] = {};
+	std::atomic<unsigned long long> mCount = 0;
+	std::atomic<long long> mMaxUs = 0;
+};
@@ -0,0 +1,169 @@
+//==============================================================================
+/**
+@file       RetryPolicy.h
+@brief      Backoff and circuit breaker for retrying failed reads
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <random>
+#include <functional> // for function
+#include <algorithm> // for min
+
+/**
+	@brief Decides how long to wait before retrying a failed read. Retries back off exponentially
+	with jitter up to a cap. After a number of failures in a row the breaker opens and only one
+	probe read is allowed per open period until a read succeeds.
+**/
+class RetryPolicy
+{
+public:
+	typedef std::chrono::steady_clock clock_t;
+
+	enum class breakerState_t
+	{
+		CLOSED, // reads are working, retry failures with backoff
+		OPEN, // too many failures, wait out the open period
+		HALF_OPEN // open period is over, a probe read is running
+	};
+
+	/**
+		@param[in] baseDelay wait after the first failure
+		@param[in] maxDelay the most the backoff waits
+		@param[in] failureThreshold failures in a row that open the breaker
+		@param[in] openDuration how long the breaker stays open before a probe read
+	**/
+	RetryPolicy(clock_t::duration baseDelay = std::chrono::seconds(5),
+		clock_t::duration maxDelay = std::chrono::minutes(5),
+		unsigned int failureThreshold = 5,
+		clock_t::duration openDuration = std::chrono::minutes(15))
+		:mBaseDelay(baseDelay),
+		mMaxDelay(maxDelay),
+		mFailureThreshold(failureThreshold),
+		mOpenDuration(openDuration),
+		mRandom(std::random_device{}())
+	{
+	}
+
+	/**
+		@brief Sets a function called with the new state whenever the breaker changes state,
+		it runs on the thread that reported the result
+	**/
+	void setOnStateChange(std::function<void(breakerState_t)> onStateChange)
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		mOnStateChange = onStateChange;
+	}
+
+	/**
+		@brief Call before a read, a read while the breaker is open is the probe
+	**/
+	void beginAttempt()
+	{
+		if (mState == breakerState_t::OPEN)
+			setState(breakerState_t::HALF_OPEN);
+	}
+
+	/**
+		@brief Call after a successful read, closes the breaker
+	**/
+	void onSuccess()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mFailureCount = 0;
+		}
+		setState(breakerState_t::CLOSED);
+	}
+
+	/**
+		@brief Call after a failed read
+
+		@return how long to wait before the next read
+	**/
+	clock_t::duration onFailure()
+	{
+		clock_t::duration delay;
+		bool isOpening = false;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			mFailureCount++;
+
+			if (mState == breakerState_t::HALF_OPEN || mFailureCount >= mFailureThreshold)
+			{
+				isOpening = true;
+				delay = mOpenDuration;
+			}
+			else
+			{
+				// base * 2^(failures - 1), capped
+				clock_t::duration backoff = mBaseDelay;
+				for (unsigned int i = 1; i < mFailureCount && backoff < mMaxDelay; i++)
+					backoff *= 2;
+				backoff = (std::min)(backoff, mMaxDelay);
+
+				// wait at least half the backoff, jitter the rest so clients don't retry in step
+				std::uniform_int_distribution<long long> jitter(0, backoff.count() / 2);
+				delay = backoff - backoff / 2 + clock_t::duration(jitter(mRandom));
+			}
+		}
+
+		if (isOpening)
+			setState(breakerState_t::OPEN);
+		return delay;
+	}
+
+	breakerState_t getState() const
+	{
+		return mState;
+	}
+
+	unsigned int getFailureCount() const
+	{
+		std::lock_guard<std::mutex> lock(mMutex);
+		return mFailureCount;
+	}
+
+	static const char* toString(breakerState_t state)
+	{
+		switch (state)
+		{
+		case breakerState_t::CLOSED: return "closed";
+		case breakerState_t::OPEN: return "open";
+		case breakerState_t::HALF_OPEN: return "half open";
+		}
+		return "";
+	}
+
+private:
+	const clock_t::duration mBaseDelay;
+	const clock_t::duration mMaxDelay;
+	const unsigned int mFailureThreshold;
+	const clock_t::duration mOpenDuration;
+
+	mutable std::mutex mMutex;
+	std::atomic<breakerState_t> mState = breakerState_t::CLOSED;
+	unsigned int mFailureCount = 0;
+	std::mt19937_64 mRandom;
+	std::function<void(breakerState_t)> mOnStateChange;
+
+	void setState(breakerState_t state)
+	{
+		std::function<void(breakerState_t)> onStateChange;
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			if (mState == state)
+				return;
+			mState = state;
+			onStateChange = mOnStateChange;
+		}
+
+		if (onStateChange)
+			onStateChange(state);
+	}
+};
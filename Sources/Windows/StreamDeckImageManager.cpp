@@ -11,12 +11,27 @@
 #include "../Vendor/lodepng/lodepng.h"
 #include "../Vendor/lodepng/lodepng.cpp"
 #include <filesystem>
+#include <climits> // for INT_MIN, INT_MAX
+#include <cstdlib> // for atoi
+#include <cstdio> // for snprintf
 
-StreamDeckImageManager::StreamDeckImageManager(const std::string & path)
-	:mPath(path)
+StreamDeckImageManager::StreamDeckImageManager(const std::string & path, std::size_t atlasBudget)
+	:mAtlasBudget(atlasBudget),
+	mPath(path)
 {
 }
 
+StreamDeckImageManager::~StreamDeckImageManager()
+{
+	{
+		std::lock_guard<std::mutex> lock(mRenderMutex);
+		mIsStopping = true;
+	}
+	mRenderCondition.notify_all();
+	if (mRenderThread.joinable())
+		mRenderThread.join();
+}
+
 /**
 	@brief Get the name of all png images in directory
 
@@ -54,31 +69,38 @@ std::set<std::string> StreamDeckImageManager::getCachedImages()
 **/
 bool StreamDeckImageManager::loadAllPng()
 {
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
 	bool isSuccess = true;
 	std::set<std::string> images = getAvailablePngImages();
 	for (const auto& imageName : images)
 		if (loadImage(imageName) == mImageNameToBase64Map.end())
 			isSuccess = false;
 
+	std::lock_guard<std::mutex> lock(mRenderMutex);
+	mAtlasStats.loadAllMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startTime).count();
 	return isSuccess;
 }
 
 /**
-	@brief Loads the image into memory as base64
+	@brief Loads the image into memory as a base64 data URI
 
 	@param[in] filename name of the image file
 
 	@return iterator to image in cache, 
 **/
-std::map<std::string, std::string>::iterator StreamDeckImageManager::loadImage(const std::string& filename)
+std::map<std::string, std::shared_ptr<const std::string>>::iterator StreamDeckImageManager::loadImage(const std::string& filename)
 {
 	std::vector<unsigned char> buffer;
 	std::string path = mPath + filename;
 	if (lodepng::load_file(buffer, path) == 0)
 	{
-		std::string base64Image;
-		imageutils::pngToBase64(base64Image, buffer);
+		std::shared_ptr<std::string> base64Image = std::make_shared<std::string>("data:image/png;base64,");
+		imageutils::pngToBase64(*base64Image, buffer);
 		
+		// images drawn from the old file are stale
+		clearRenderedImages(filename);
+
 		// store to cache
 		auto imageIt = mImageNameToBase64Map.find(filename);
 		if (imageIt == mImageNameToBase64Map.end())
@@ -104,19 +126,20 @@ bool StreamDeckImageManager::unloadImage(const std::string& filename)
 	if (imageIt != mImageNameToBase64Map.end())
 	{
 		mImageNameToBase64Map.erase(imageIt);
+		clearRenderedImages(filename);
 		return true;
 	}
 	return false;
 }
 
 /**
-	@brief Gets base64 string of image
+	@brief Gets the data URI of an image, shared so sending it doesn't copy it
 
 	@param[in] filename name of the image file
 
-	@return base64 string of image, "" string if error
+	@return base64 data URI of image, "" string if error
 **/
-const std::string StreamDeckImageManager::getImage(const std::string& filename)
+std::shared_ptr<const std::string> StreamDeckImageManager::getImage(const std::string& filename)
 {
 	if (filename.length() > 0)
 	{
@@ -131,5 +154,356 @@ const std::string StreamDeckImageManager::getImage(const std::string& filename)
 				return imageIt->second;
 		}
 	}
-	return "";
-}
\ No newline at end of file
+	return mEmptyImage;
+}
+
+/**
+	@brief Gets the data URI of an icon with the progress bar and level drawn over it.
+	The first request for an icon and level renders that frame right away and queues the
+	rest of the icon's frames for the render thread, later requests are a lookup.
+
+	@param[in] filename name of the image file, a blank image is used if empty or not loadable
+	@param[in] progress progress in percent
+	@param[in] level level text, its digits are drawn as a badge
+	@param[in] profile how to encode the frame if it has to be rendered now, the background always uses COMPACT
+
+	@return base64 data URI of image, "" string if error
+**/
+std::shared_ptr<const std::string> StreamDeckImageManager::getProgressImage(const std::string& filename, float progress, const std::string& level,
+	encodeProfile_t profile)
+{
+	int progressStep = (int)((std::min)((std::max)(progress, 0.0f), 100.0f) / 100.0f * PROGRESS_STEPS + 0.5f);
+
+	// level text may have words around the number
+	int levelNumber = -1;
+	std::size_t digitPos = level.find_first_of("0123456789");
+	if (digitPos != std::string::npos)
+		levelNumber = std::atoi(level.c_str() + digitPos);
+
+	atlasKey_t key(filename, levelNumber);
+	std::unique_lock<std::mutex> lock(mRenderMutex);
+	if (!mHasFirstRequest)
+	{
+		mHasFirstRequest = true;
+		mFirstRequestTime = std::chrono::steady_clock::now();
+	}
+
+	auto atlasIt = mAtlases.find(key);
+	if (atlasIt == mAtlases.end())
+	{
+		atlasIt = mAtlases.insert({ key, atlas_t{} }).first;
+		atlasIt->second.id = ++mNextAtlasId;
+		atlasIt->second.frames.resize(PROGRESS_STEPS + 1);
+
+		// first time this icon is shown at this level, render its other frames in the background
+		mRenderQueue.push_back({ key, atlasIt->second.id });
+		if (!mRenderThread.joinable())
+			mRenderThread = std::thread(&StreamDeckImageManager::renderAtlases, this);
+		mRenderCondition.notify_one();
+	}
+
+	atlas_t& atlas = atlasIt->second;
+	atlas.lastUse = ++mUseCount;
+	if (atlas.frames[progressStep] != nullptr)
+		return atlas.frames[progressStep];
+
+	// the frame is needed now, render it here instead of waiting for the render thread
+	unsigned int id = atlas.id;
+	std::shared_ptr<const imageutils::rgbaImage_t> icon = getDecodedImage(filename);
+	lock.unlock();
+
+	std::shared_ptr<const std::string> frame = encodeProgressImage(*icon, progressStep, levelNumber, profile);
+	if (frame == nullptr)
+		return mEmptyImage;
+
+	lock.lock();
+	insertFrame(key, id, progressStep, frame);
+	return frame;
+}
+
+/**
+	@brief Get the memory use and timing of the progress frames
+
+	@return the current stats
+**/
+StreamDeckImageManager::atlasStats_t StreamDeckImageManager::getAtlasStats()
+{
+	std::lock_guard<std::mutex> lock(mRenderMutex);
+	atlasStats_t stats = mAtlasStats;
+	stats.atlases = mAtlases.size();
+	stats.budget = mAtlasBudget;
+	return stats;
+}
+
+/**
+	@brief Format atlas stats for logging
+
+	@param[in] stats the stats to format
+
+	@return one line summary
+**/
+std::string StreamDeckImageManager::formatAtlasStats(const atlasStats_t& stats)
+{
+	char buffer[320];
+	snprintf(buffer, sizeof(buffer),
+		"atlases %zu, frames %zu, %zu of %zu bytes, generated %zu, evicted %zu, "
+		"load all %.1fms, first atlas %.1fms, last atlas %.1fms",
+		stats.atlases, stats.frames, stats.bytes, stats.budget, stats.generated, stats.evicted,
+		stats.loadAllMs, stats.firstAtlasMs, stats.lastAtlasMs);
+	return buffer;
+}
+
+/**
+	@brief Gets an icon decoded to RGBA, decoding it on first use
+
+	@param[in] filename name of the image file
+
+	@return the decoded icon, a blank image if it could not be decoded
+**/
+std::shared_ptr<const imageutils::rgbaImage_t> StreamDeckImageManager::getDecodedImage(const std::string& filename)
+{
+	// warning: lock mRenderMutex before calling!
+
+	auto decodedIt = mDecodedImages.find(filename);
+	if (decodedIt != mDecodedImages.end())
+		return decodedIt->second;
+
+	std::shared_ptr<imageutils::rgbaImage_t> image = std::make_shared<imageutils::rgbaImage_t>();
+	if (filename.length() == 0 || lodepng::decode(image->pixels, image->width, image->height, mPath + filename) != 0)
+	{
+		image->width = ICON_SIZE;
+		image->height = ICON_SIZE;
+		image->pixels.assign(ICON_SIZE * ICON_SIZE * 4, 0);
+	}
+	mDecodedImages.insert({ filename, image });
+	return image;
+}
+
+/**
+	@brief Drops the decoded icon and the progress frames drawn from it
+
+	@param[in] filename name of the image file
+**/
+void StreamDeckImageManager::clearRenderedImages(const std::string& filename)
+{
+	std::lock_guard<std::mutex> lock(mRenderMutex);
+	mDecodedImages.erase(filename);
+
+	// keys sort by file name first, so the icon's atlases are one range
+	auto first = mAtlases.lower_bound(atlasKey_t(filename, INT_MIN));
+	auto last = mAtlases.upper_bound(atlasKey_t(filename, INT_MAX));
+	for (auto atlasIt = first; atlasIt != last; ++atlasIt)
+	{
+		mAtlasStats.bytes -= atlasIt->second.bytes;
+		mAtlasStats.frames -= atlasIt->second.frameCount;
+	}
+	mAtlases.erase(first, last);
+}
+
+/**
+	@brief Stores a rendered frame in its atlas, dropping the least recently used other
+	atlases if it doesn't fit in the budget
+
+	@param[in] key the atlas of the frame
+	@param[in] id id of the atlas when the frame's render started
+	@param[in] progressStep the frame's progress step
+	@param[in] frame the frame's data URI
+
+	@return false if the atlas is gone or the frame doesn't fit
+**/
+bool StreamDeckImageManager::insertFrame(const atlasKey_t& key, unsigned int id, int progressStep, const std::shared_ptr<const std::string>& frame)
+{
+	// warning: lock mRenderMutex before calling!
+
+	auto atlasIt = mAtlases.find(key);
+	if (atlasIt == mAtlases.end() || atlasIt->second.id != id)
+		return false;
+	if (atlasIt->second.frames[progressStep] != nullptr)
+		return true;
+
+	while (mAtlasStats.bytes + frame->size() > mAtlasBudget)
+	{
+		auto victimIt = mAtlases.end();
+		for (auto it = mAtlases.begin(); it != mAtlases.end(); ++it)
+			if (it != atlasIt && (victimIt == mAtlases.end() || it->second.lastUse < victimIt->second.lastUse))
+				victimIt = it;
+		if (victimIt == mAtlases.end())
+			return false;
+
+		mAtlasStats.bytes -= victimIt->second.bytes;
+		mAtlasStats.frames -= victimIt->second.frameCount;
+		mAtlasStats.evicted++;
+		mAtlases.erase(victimIt);
+	}
+
+	atlas_t& atlas = atlasIt->second;
+	atlas.frames[progressStep] = frame;
+	atlas.bytes += frame->size();
+	atlas.frameCount++;
+	mAtlasStats.bytes += frame->size();
+	mAtlasStats.frames++;
+	return true;
+}
+
+/**
+	@brief Render thread, fills in the missing frames of queued atlases until stopped
+**/
+void StreamDeckImageManager::renderAtlases()
+{
+	std::unique_lock<std::mutex> lock(mRenderMutex);
+	while (true)
+	{
+		mRenderCondition.wait(lock, [this]() { return mIsStopping || !mRenderQueue.empty(); });
+		if (mIsStopping)
+			return;
+
+		std::pair<atlasKey_t, unsigned int> job = mRenderQueue.front();
+		mRenderQueue.pop_front();
+
+		std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+		std::shared_ptr<const imageutils::rgbaImage_t> icon = getDecodedImage(job.first.first);
+		bool isComplete = true;
+		for (int progressStep = 0; progressStep <= PROGRESS_STEPS && isComplete; progressStep++)
+		{
+			// the atlas may have been dropped or the frame shown already
+			auto atlasIt = mAtlases.find(job.first);
+			if (mIsStopping || atlasIt == mAtlases.end() || atlasIt->second.id != job.second)
+			{
+				isComplete = false;
+				break;
+			}
+			if (atlasIt->second.frames[progressStep] != nullptr)
+				continue;
+
+			// render without the lock so requests for frames that are ready don't wait,
+			// nobody is waiting for these so spend the time on a smaller image
+			lock.unlock();
+			std::shared_ptr<const std::string> frame = encodeProgressImage(*icon, progressStep, job.first.second, encodeProfile_t::COMPACT);
+			lock.lock();
+
+			isComplete = frame != nullptr && insertFrame(job.first, job.second, progressStep, frame);
+		}
+
+		if (isComplete)
+		{
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			mAtlasStats.generated++;
+			mAtlasStats.lastAtlasMs = std::chrono::duration<double, std::milli>(now - startTime).count();
+			if (mAtlasStats.generated == 1)
+				mAtlasStats.firstAtlasMs = std::chrono::duration<double, std::milli>(now - mFirstRequestTime).count();
+		}
+	}
+}
+
+/**
+	@brief Draws a progress frame and encodes it as a data URI
+
+	@param[in] icon the icon to draw on
+	@param[in] progressStep progress in steps of PROGRESS_STEPS
+	@param[in] level level to draw, not drawn if negative
+	@param[in] profile how to encode it
+
+	@return the data URI, nullptr if encoding failed
+**/
+std::shared_ptr<const std::string> StreamDeckImageManager::encodeProgressImage(const imageutils::rgbaImage_t& icon, int progressStep, int level,
+	encodeProfile_t profile)
+{
+	imageutils::rgbaImage_t image = renderProgressImage(icon, progressStep, level);
+
+	std::vector<unsigned char> png;
+	if (encodePng(png, image, profile) != 0)
+		return nullptr;
+
+	std::shared_ptr<std::string> base64Image = std::make_shared<std::string>("data:image/png;base64,");
+	imageutils::pngToBase64(*base64Image, png);
+	return base64Image;
+}
+
+/**
+	@brief Encodes an RGBA image as png
+
+	@param[out] out the png file
+	@param[in] image the image to encode
+	@param[in] profile how to encode it
+
+	@return lodepng error code, 0 on success
+**/
+unsigned StreamDeckImageManager::encodePng(std::vector<unsigned char>& out, const imageutils::rgbaImage_t& image, encodeProfile_t profile)
+{
+	if (profile == encodeProfile_t::COMPACT)
+		return lodepng::encode(out, image.pixels, image.width, image.height);
+
+	// auto_convert stays at its default (on): keys are opaque, letting lodepng drop the alpha channel makes the image both smaller and faster to encode
+	lodepng::State state;
+
+	std::vector<unsigned char> filters;
+	if (profile == encodeProfile_t::FAST)
+	{
+		// paeth on every row is close to the per row search on the icons at a fraction of the cost
+		filters.assign(image.height, 4);
+		state.encoder.filter_strategy = LFS_PREDEFINED;
+		state.encoder.predefined_filters = filters.data();
+		state.encoder.zlibsettings.windowsize = 256;
+		state.encoder.zlibsettings.nicematch = 32;
+		state.encoder.zlibsettings.lazymatching = 0;
+	}
+	else
+	{
+		state.encoder.filter_strategy = LFS_ZERO;
+		state.encoder.zlibsettings.btype = 0;
+	}
+
+	return lodepng::encode(out, image.pixels, image.width, image.height, state);
+}
+
+/**
+	@brief Draws the progress bar along the bottom of an icon and the level in its top right corner
+
+	@param[in] icon the icon to draw on
+	@param[in] progressStep progress in steps of PROGRESS_STEPS
+	@param[in] level level to draw, not drawn if negative
+
+	@return the drawn image
+**/
+imageutils::rgbaImage_t StreamDeckImageManager::renderProgressImage(const imageutils::rgbaImage_t& icon, int progressStep, int level)
+{
+	const imageutils::rgba_t trackColor = { 0, 0, 0, 160 };
+	const imageutils::rgba_t fillColor = { 92, 184, 232, 255 };
+	const imageutils::rgba_t completedColor = { 232, 196, 92, 255 };
+	const imageutils::rgba_t badgeColor = { 0, 0, 0, 176 };
+	const imageutils::rgba_t textColor = { 255, 255, 255, 255 };
+
+	imageutils::rgbaImage_t image = icon;
+	int width = (int)image.width;
+	int height = (int)image.height;
+
+	// everything is laid out relative to a 144 pixel key
+	int unit = (std::max)(width / 48, 1);
+
+	// progress bar, a dark track with the progress filled in over it
+	int barMargin = 4 * unit;
+	int barHeight = 4 * unit;
+	int barWidth = width - 2 * barMargin;
+	int barTop = height - barMargin - barHeight;
+	imageutils::fillRect(image, barMargin, barTop, barWidth, barHeight, trackColor);
+	int fillWidth = barWidth * progressStep / PROGRESS_STEPS;
+	imageutils::fillRect(image, barMargin, barTop, fillWidth, barHeight,
+		(progressStep >= PROGRESS_STEPS) ? completedColor : fillColor);
+
+	// level badge
+	if (level >= 0)
+	{
+		std::string digits = std::to_string(level);
+		int textWidth = 0;
+		int textHeight = 0;
+		imageutils::measureDigits(digits, 2 * unit, textWidth, textHeight);
+
+		int padding = 2 * unit;
+		int badgeWidth = textWidth + 2 * padding;
+		int badgeLeft = width - barMargin - badgeWidth;
+		imageutils::fillRect(image, badgeLeft, barMargin, badgeWidth, textHeight + 2 * padding, badgeColor);
+		imageutils::drawDigits(image, badgeLeft + padding, barMargin + padding, 2 * unit, digits, textColor);
+	}
+
+	return image;
+}
@@ -9,26 +9,107 @@
 #pragma once
 
 #include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <deque>
+#include <chrono>
 
 #include "ImageUtils.h"
 
 class StreamDeckImageManager
 {
 public:
-	StreamDeckImageManager(const std::string& path);
+	// how progress images are encoded, trading payload size for encode time
+	enum class encodeProfile_t
+	{
+		COMPACT, // lodepng's defaults, searches filters per row and compresses hardest
+		FAST, // one filter for every row and a small deflate window, about half the time for a slightly bigger image
+		STORED // no compression, for when the image is needed right away
+	};
+
+	// memory and timing of the pre-rendered progress frames
+	struct atlasStats_t
+	{
+		std::size_t atlases = 0; // icon and level pairs with frames in memory
+		std::size_t frames = 0;
+		std::size_t bytes = 0; // size of the frames' data URIs
+		std::size_t budget = 0;
+		std::size_t generated = 0; // atlases fully rendered in the background
+		std::size_t evicted = 0; // atlases dropped to stay in the budget
+		double loadAllMs = 0.0; // the last loadAllPng
+		double firstAtlasMs = 0.0; // from the first progress image request until its atlas was complete
+		double lastAtlasMs = 0.0; // time to render the last generated atlas
+	};
+
+	StreamDeckImageManager(const std::string& path, std::size_t atlasBudget = 32 * 1024 * 1024);
+	~StreamDeckImageManager();
 
 	bool unloadImage(const std::string& filename);
-	const std::string getImage(const std::string& filename);
+	std::shared_ptr<const std::string> getImage(const std::string& filename);
+	std::shared_ptr<const std::string> getProgressImage(const std::string& filename, float progress, const std::string& level,
+		encodeProfile_t profile = encodeProfile_t::FAST);
 	bool loadAllPng();
 
 	std::set<std::string> getAvailablePngImages();
 	std::set<std::string> getCachedImages();
 
+	atlasStats_t getAtlasStats();
+	static std::string formatAtlasStats(const atlasStats_t& stats);
+
+	static unsigned encodePng(std::vector<unsigned char>& out, const imageutils::rgbaImage_t& image, encodeProfile_t profile);
+
 private:
-	// contains cache of base64 images that have been loaded
-	std::map<std::string, std::string> mImageNameToBase64Map;
+	// contains cache of images that have been loaded, stored as ready to send data URIs
+	// that are shared with the messages sending them
+	std::map<std::string, std::shared_ptr<const std::string>> mImageNameToBase64Map;
+	const std::shared_ptr<const std::string> mEmptyImage = std::make_shared<const std::string>();
+
+	std::map<std::string, std::shared_ptr<const std::string>>::iterator loadImage(const std::string& filename);
+
+	// protects the members below, they are used by the render thread too
+	std::mutex mRenderMutex;
+
+	// icons decoded to RGBA, the base the progress images are drawn on
+	std::map<std::string, std::shared_ptr<const imageutils::rgbaImage_t>> mDecodedImages;
+	std::shared_ptr<const imageutils::rgbaImage_t> getDecodedImage(const std::string& filename);
+
+	// every progress frame of an icon at one level, rendered in the background the first time
+	// the pair is shown so later progress changes are a lookup
+	typedef std::pair<std::string, int> atlasKey_t; // icon file name, level
+	struct atlas_t
+	{
+		unsigned int id = 0; // tells a render that its atlas was dropped and made again
+		std::vector<std::shared_ptr<const std::string>> frames; // data URIs by progress step, nullptr until rendered
+		std::size_t frameCount = 0;
+		std::size_t bytes = 0;
+		unsigned long long lastUse = 0;
+	};
+	std::map<atlasKey_t, atlas_t> mAtlases;
+	unsigned int mNextAtlasId = 0;
+	unsigned long long mUseCount = 0;
+	const std::size_t mAtlasBudget;
+	atlasStats_t mAtlasStats;
+	std::chrono::steady_clock::time_point mFirstRequestTime;
+	bool mHasFirstRequest = false;
+
+	void clearRenderedImages(const std::string& filename);
+	bool insertFrame(const atlasKey_t& key, unsigned int id, int progressStep, const std::shared_ptr<const std::string>& frame);
+
+	// atlases waiting for the render thread
+	std::deque<std::pair<atlasKey_t, unsigned int>> mRenderQueue;
+	std::condition_variable mRenderCondition;
+	std::thread mRenderThread;
+	bool mIsStopping = false;
+	void renderAtlases();
 
-	std::map<std::string, std::string>::iterator loadImage(const std::string& filename);
+	static const int PROGRESS_STEPS = 100; // progress is drawn in whole percents
+	static const unsigned int ICON_SIZE = 144; // size of the blank image used when there is no icon
+	static imageutils::rgbaImage_t renderProgressImage(const imageutils::rgbaImage_t& icon, int progressStep, int level);
+	static std::shared_ptr<const std::string> encodeProgressImage(const imageutils::rgbaImage_t& icon, int progressStep, int level,
+		encodeProfile_t profile);
 
 	const std::string mPath;
 };
\ No newline at end of file
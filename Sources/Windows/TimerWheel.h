@@ -0,0 +1,294 @@
+//==============================================================================
+/**
+@file       TimerWheel.h
+@brief      Hierarchical timer wheel used by CallBackTimer to order job deadlines
+@copyright  (c) 2020, Momoko Tomoko
+**/
+//==============================================================================
+
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <unordered_map>
+#include <vector>
+#include <algorithm> // for partial_sort
+
+/**
+	@brief Keeps ids sorted into slots by the tick they expire on. Each level has 64 slots,
+	a slot of level L spans 64^L ticks, so 4 levels cover 2^24 ticks. Insert and cancel are O(1),
+	entries in higher levels move down a level when the wheel turns past their slot.
+**/
+class TimerWheel
+{
+public:
+	typedef unsigned int id_t;
+	typedef std::chrono::steady_clock clock_t;
+
+	/**
+		@param[in] tick resolution of the wheel, deadlines are rounded up to it
+	**/
+	TimerWheel(clock_t::duration tick)
+		:mTick(tick),
+		mOrigin(clock_t::now())
+	{
+	}
+
+	/**
+		@brief Schedules an id, replacing its previous deadline
+
+		@param[in] id the id to schedule
+		@param[in] deadline the earliest time the id expires
+		@param[in] tolerance how much later it may expire, used to line it up with other ids
+	**/
+	void insert(id_t id, clock_t::time_point deadline, clock_t::duration tolerance = clock_t::duration::zero())
+	{
+		cancel(id);
+
+		uint64_t expiry = toTickCeil(deadline);
+		uint64_t latest = (std::max)(expiry, toTickFloor(deadline + tolerance));
+
+		// round to the coarsest power of two boundary inside the window so ids due around
+		// the same time land on the same tick and run together
+		for (int bits = LEVEL_BITS * LEVEL_COUNT; bits > 0; bits--)
+		{
+			uint64_t aligned = ((expiry + (1ULL << bits) - 1) >> bits) << bits;
+			if (aligned <= latest)
+			{
+				expiry = aligned;
+				break;
+			}
+		}
+
+		entry_t& entry = mEntries[id];
+		entry.expiry = expiry;
+
+		// already due, or the slot for the current tick has been handled
+		if (expiry <= mCurrentTick || deadline <= clock_t::now())
+		{
+			entry.level = DUE_LEVEL;
+			entry.it = mDue.insert(mDue.end(), id);
+			return;
+		}
+
+		std::list<id_t> pending;
+		entry.it = pending.insert(pending.end(), id);
+		place(pending, entry);
+	}
+
+	/**
+		@brief Removes an id
+
+		@param[in] id the id to remove
+
+		@return true if the id was scheduled
+	**/
+	bool cancel(id_t id)
+	{
+		auto it = mEntries.find(id);
+		if (it == mEntries.end())
+			return false;
+
+		listOf(it->second).erase(it->second.it);
+		mEntries.erase(it);
+		return true;
+	}
+
+	/**
+		@brief Turns the wheel up to a time and collects the ids that expired
+
+		@param[in] now the time to turn to
+		@param[out] expired ids that expired are appended to this
+	**/
+	void advance(clock_t::time_point now, std::vector<id_t>& expired)
+	{
+		takeAll(mDue, expired);
+
+		uint64_t target = toTickFloor(now);
+		while (mCurrentTick < target)
+		{
+			if (mEntries.empty())
+			{
+				mCurrentTick = target;
+				break;
+			}
+
+			mCurrentTick++;
+
+			// at the start of a lap, bring the next slot of the level above down a level
+			for (int level = 1; level < LEVEL_COUNT; level++)
+			{
+				if ((mCurrentTick & ((1ULL << (LEVEL_BITS * level)) - 1)) != 0)
+					break;
+				cascade(level);
+			}
+
+			takeAll(mSlots[0][mCurrentTick & SLOT_MASK], expired);
+		}
+	}
+
+	/**
+		@brief Finds when the next id expires
+
+		@param[out] deadline the time of the earliest expiry
+
+		@return false if nothing is scheduled
+	**/
+	bool getNextDeadline(clock_t::time_point& deadline) const
+	{
+		if (!mDue.empty())
+		{
+			deadline = toTime(mCurrentTick);
+			return true;
+		}
+
+		// the first non empty slot after the current one holds the earliest entries of each level
+		bool isFound = false;
+		uint64_t earliest = 0;
+		for (int level = 0; level < LEVEL_COUNT; level++)
+		{
+			uint64_t current = (mCurrentTick >> (LEVEL_BITS * level)) & SLOT_MASK;
+			for (uint64_t i = 1; i <= SLOT_COUNT; i++)
+			{
+				const std::list<id_t>& slot = mSlots[level][(current + i) & SLOT_MASK];
+				if (slot.empty())
+					continue;
+
+				for (const auto& id : slot)
+				{
+					uint64_t expiry = mEntries.at(id).expiry;
+					if (!isFound || expiry < earliest)
+					{
+						earliest = expiry;
+						isFound = true;
+					}
+				}
+				break;
+			}
+		}
+
+		if (isFound)
+			deadline = toTime(earliest);
+		return isFound;
+	}
+
+	/**
+		@brief Lists the upcoming expiries, for logging and inspection
+
+		@param[in] count the maximum number of entries to return
+
+		@return id and expiry time pairs, earliest first
+	**/
+	std::vector<std::pair<id_t, clock_t::time_point>> getNextDeadlines(std::size_t count) const
+	{
+		std::vector<std::pair<uint64_t, id_t>> sorted;
+		sorted.reserve(mEntries.size());
+		for (const auto& entry : mEntries)
+			sorted.push_back({ entry.second.expiry, entry.first });
+
+		count = (std::min)(count, sorted.size());
+		std::partial_sort(sorted.begin(), sorted.begin() + count, sorted.end());
+
+		std::vector<std::pair<id_t, clock_t::time_point>> deadlines;
+		deadlines.reserve(count);
+		for (std::size_t i = 0; i < count; i++)
+			deadlines.push_back({ sorted[i].second, toTime(sorted[i].first) });
+		return deadlines;
+	}
+
+	bool empty() const
+	{
+		return mEntries.empty();
+	}
+
+private:
+	static const int LEVEL_BITS = 6;
+	static const int LEVEL_COUNT = 4;
+	static const uint64_t SLOT_COUNT = 1ULL << LEVEL_BITS;
+	static const uint64_t SLOT_MASK = SLOT_COUNT - 1;
+	static const int DUE_LEVEL = -1;
+
+	struct entry_t
+	{
+		uint64_t expiry = 0; // tick the id expires on
+		int level = DUE_LEVEL;
+		uint64_t slot = 0;
+		std::list<id_t>::iterator it; // position in the slot's list, stays valid when spliced
+	};
+
+	const clock_t::duration mTick;
+	const clock_t::time_point mOrigin;
+	uint64_t mCurrentTick = 0; // every slot up to and including this tick has been handled
+
+	std::list<id_t> mSlots[LEVEL_COUNT][SLOT_COUNT];
+	std::list<id_t> mDue;
+	std::unordered_map<id_t, entry_t> mEntries;
+
+	std::list<id_t>& listOf(const entry_t& entry)
+	{
+		return (entry.level == DUE_LEVEL) ? mDue : mSlots[entry.level][entry.slot];
+	}
+
+	/**
+		@brief Moves an entry's list node from a list into the slot matching its expiry
+	**/
+	void place(std::list<id_t>& from, entry_t& entry)
+	{
+		uint64_t delta = (entry.expiry > mCurrentTick) ? entry.expiry - mCurrentTick : 0;
+
+		int level = 0;
+		while (level < LEVEL_COUNT - 1 && delta >= (1ULL << (LEVEL_BITS * (level + 1))))
+			level++;
+
+		// beyond the last level, park it in the furthest slot and place it again when it cascades
+		uint64_t expiry = entry.expiry;
+		uint64_t maxDelta = (1ULL << (LEVEL_BITS * LEVEL_COUNT)) - 1;
+		if (delta > maxDelta)
+			expiry = mCurrentTick + maxDelta;
+
+		entry.level = level;
+		entry.slot = (expiry >> (LEVEL_BITS * level)) & SLOT_MASK;
+		std::list<id_t>& to = mSlots[entry.level][entry.slot];
+		to.splice(to.end(), from, entry.it);
+	}
+
+	void cascade(int level)
+	{
+		std::list<id_t> pending;
+		pending.swap(mSlots[level][(mCurrentTick >> (LEVEL_BITS * level)) & SLOT_MASK]);
+		while (!pending.empty())
+			place(pending, mEntries.at(pending.front()));
+	}
+
+	void takeAll(std::list<id_t>& slot, std::vector<id_t>& expired)
+	{
+		for (const auto& id : slot)
+		{
+			expired.push_back(id);
+			mEntries.erase(id);
+		}
+		slot.clear();
+	}
+
+	uint64_t toTickFloor(clock_t::time_point time) const
+	{
+		if (time <= mOrigin)
+			return 0;
+		return (uint64_t)((time - mOrigin) / mTick);
+	}
+
+	uint64_t toTickCeil(clock_t::time_point time) const
+	{
+		if (time <= mOrigin)
+			return 0;
+		clock_t::duration elapsed = time - mOrigin;
+		uint64_t ticks = (uint64_t)(elapsed / mTick);
+		return (elapsed % mTick == clock_t::duration::zero()) ? ticks : ticks + 1;
+	}
+
+	clock_t::time_point toTime(uint64_t tick) const
+	{
+		return mOrigin + mTick * (long long)tick;
+	}
+};